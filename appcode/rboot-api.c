@@ -12,6 +12,9 @@
 #include <spi_flash.h>
 
 #include "rboot-api.h"
+#if defined(BOOT_SIGNATURE) || defined(BOOT_ROM_DIGEST) || defined(BOOT_BUNDLE)
+#include "rboot-sha256.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,6 +33,57 @@ static uint8_t calc_chksum(uint8_t *start, uint8_t *end) {
 }
 #endif
 
+#ifdef BOOT_BLOCK_ERASE
+// plain sdk defaults to iram
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+#define BLOCK_SIZE 0x10000
+
+extern void Cache_Read_Disable_2(void);
+extern void Cache_Read_Enable_2(void);
+extern uint32_t SPIEraseBlock(uint32_t block);
+
+// erase a 64KB block, the sdk only provides sector erase so use the
+// rom function, with the flash cache disabled in the same way as the
+// sdk does for its own flash operations (so this must be in iram)
+static SpiFlashOpResult IRAM_ATTR erase_block(uint32_t block) {
+	uint32_t ret;
+	Cache_Read_Disable_2();
+	ret = SPIEraseBlock(block);
+	Cache_Read_Enable_2();
+	return (ret == 0) ? SPI_FLASH_RESULT_OK : SPI_FLASH_RESULT_ERR;
+}
+#endif
+
+#ifdef BOOT_OTA_STATS
+// record the time taken by a write call
+static void ICACHE_FLASH_ATTR stats_call(rboot_write_stats *stats, uint32_t us) {
+#if RBOOT_STATS_BUCKETS > 0
+	uint8_t bucket = 0;
+	while (bucket < RBOOT_STATS_BUCKETS - 1 && us >= (1000u << bucket)) {
+		bucket++;
+	}
+	if (stats->latency[bucket] < 0xffff) stats->latency[bucket]++;
+#endif
+	stats->calls++;
+	if (us > stats->worst_call_us) stats->worst_call_us = us;
+}
+
+// record heap use by a write call
+static void ICACHE_FLASH_ATTR stats_heap(rboot_write_stats *stats, uint32_t size) {
+	uint32_t free = system_get_free_heap_size();
+	if (size > stats->heap_peak) stats->heap_peak = size;
+	if (free < stats->heap_free_min) stats->heap_free_min = free;
+}
+#endif
+
+// rom image header values (see rboot-private.h)
+#define ROM_MAGIC      0xe9
+#define ROM_MAGIC_NEW1 0xea
+#define ROM_MAGIC_NEW2 0x04
+
 // get the rboot config
 rboot_config ICACHE_FLASH_ATTR rboot_get_config(void) {
 	rboot_config conf;
@@ -57,6 +111,9 @@ bool ICACHE_FLASH_ATTR rboot_set_config(rboot_config *conf) {
 	memcpy(buffer, conf, sizeof(rboot_config));
 	spi_flash_erase_sector(BOOT_CONFIG_SECTOR);
 	spi_flash_write(BOOT_CONFIG_SECTOR * SECTOR_SIZE, (uint32_t*)((void*)buffer), SECTOR_SIZE);
+#ifdef BOOT_READ_CACHE
+	rboot_cache_invalidate(BOOT_CONFIG_SECTOR * SECTOR_SIZE, SECTOR_SIZE);
+#endif
 	
 	vPortFree(buffer, 0, 0);
 	return true;
@@ -78,19 +135,209 @@ bool ICACHE_FLASH_ATTR rboot_set_current_rom(uint8_t rom) {
 	return rboot_set_config(&conf);
 }
 
+#if defined(BOOT_SIGNATURE) || defined(BOOT_ROM_DIGEST) || defined(BOOT_BUNDLE)
+// sha256 of an area of the flash
+static bool ICACHE_FLASH_ATTR hash_flash(uint32_t addr, uint32_t len, uint8_t *digest) {
+	rboot_sha256_ctx ctx;
+	uint32_t buffer[64];
+	uint32_t pos;
+	uint32_t readlen;
+
+	rboot_sha256_init(&ctx);
+	for (pos = 0; pos < len; pos += readlen) {
+		readlen = (len - pos < sizeof(buffer)) ? len - pos : sizeof(buffer);
+		if (spi_flash_read(addr + pos, buffer, (readlen + 3) & ~3) != SPI_FLASH_RESULT_OK) {
+			return false;
+		}
+		rboot_sha256_update(&ctx, (uint8_t*)buffer, readlen);
+	}
+	rboot_sha256_final(&ctx, digest);
+	return true;
+}
+#endif
+
+#if defined(BOOT_SIGNATURE) || defined(BOOT_ROM_DIGEST)
+// a rom is about to be rewritten, move it to a new write generation
+// so any existing attestation no longer applies and forget its digest
+// returns true if the address is a rom and the config was changed
+static bool ICACHE_FLASH_ATTR invalidate_config(rboot_config *conf, uint32_t start_addr) {
+	uint8_t rom;
+	for (rom = 0; rom < conf->count && rom < MAX_ROMS; rom++) {
+		if (conf->roms[rom] == start_addr) {
+#ifdef BOOT_SIGNATURE
+			// skip 0 on wrap, it marks a factory installed rom
+			conf->generation[rom] = (conf->generation[rom] == 0xff) ? 1 : conf->generation[rom] + 1;
+#endif
+#ifdef BOOT_ROM_DIGEST
+			memset(conf->digest[rom], 0, RBOOT_DIGEST_LEN);
+#endif
+			return true;
+		}
+	}
+	return false;
+}
+
+static void ICACHE_FLASH_ATTR invalidate_rom(uint32_t start_addr) {
+	rboot_config conf;
+	conf = rboot_get_config();
+	if (invalidate_config(&conf, start_addr)) {
+		rboot_set_config(&conf);
+	}
+}
+#endif
+
+#ifdef BOOT_ROM_DIGEST
+// a rom has been written, record the digest of its contents
+static bool ICACHE_FLASH_ATTR record_digest(uint32_t start_addr, uint32_t len) {
+	rboot_config conf;
+	uint8_t rom;
+	conf = rboot_get_config();
+	for (rom = 0; rom < conf.count && rom < MAX_ROMS; rom++) {
+		if (conf.roms[rom] == start_addr) {
+			if (!hash_flash(start_addr, len, conf.digest[rom])) {
+				return false;
+			}
+			return rboot_set_config(&conf);
+		}
+	}
+	// not a rom slot, nothing to record
+	return true;
+}
+
+// find a rom slot that already holds the image with the specified digest
+bool ICACHE_FLASH_ATTR rboot_find_rom(const uint8_t *digest, uint8_t *rom) {
+	rboot_config conf;
+	uint8_t loop;
+	conf = rboot_get_config();
+	for (loop = 0; loop < conf.count && loop < MAX_ROMS; loop++) {
+		if (memcmp(conf.digest[loop], digest, RBOOT_DIGEST_LEN) == 0) {
+			*rom = loop;
+			return true;
+		}
+	}
+	return false;
+}
+#endif
+
+// get the length of the rom image at the specified flash address,
+// up to and including the checksum byte, returns 0 if not a valid rom
+uint32_t ICACHE_FLASH_ATTR rboot_get_rom_length(uint32_t addr) {
+	uint32_t header[2];
+	uint8_t *magic = (uint8_t*)header;
+	uint32_t readpos = addr;
+	uint8_t count;
+
+	if (spi_flash_read(readpos, header, sizeof(header)) != SPI_FLASH_RESULT_OK) {
+		return 0;
+	}
+	if (magic[0] == ROM_MAGIC_NEW1 && magic[1] == ROM_MAGIC_NEW2) {
+		// new type, skip the extra header and irom section
+		if (spi_flash_read(readpos + sizeof(header), header, sizeof(header)) != SPI_FLASH_RESULT_OK) {
+			return 0;
+		}
+		readpos += (sizeof(header) * 2) + header[1];
+		if (spi_flash_read(readpos, header, sizeof(header)) != SPI_FLASH_RESULT_OK) {
+			return 0;
+		}
+	}
+	if (magic[0] != ROM_MAGIC) {
+		return 0;
+	}
+	count = magic[1];
+	readpos += sizeof(header);
+
+	// skip over each section
+	while (count-- > 0) {
+		if ((readpos & 3) != 0 || readpos - addr > 0x100000 ||
+			spi_flash_read(readpos, header, sizeof(header)) != SPI_FLASH_RESULT_OK) {
+			return 0;
+		}
+		readpos += sizeof(header) + header[1];
+	}
+
+	// checksum is the last byte of the 16 byte block
+	return ((readpos | 0x0f) + 1) - addr;
+}
+
+// erase all the sectors covering the specified area, using
+// block erases for any aligned 64KB runs (if enabled)
+bool ICACHE_FLASH_ATTR rboot_erase_flash(uint32_t addr, uint32_t len) {
+	uint32_t sector = addr / SECTOR_SIZE;
+	uint32_t end = (addr + len + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+#ifdef BOOT_READ_CACHE
+	rboot_cache_invalidate(sector * SECTOR_SIZE, (end - sector) * SECTOR_SIZE);
+#endif
+	while (sector < end) {
+#ifdef BOOT_BLOCK_ERASE
+		if ((sector % (BLOCK_SIZE / SECTOR_SIZE)) == 0 && end - sector >= (BLOCK_SIZE / SECTOR_SIZE)) {
+			if (erase_block(sector / (BLOCK_SIZE / SECTOR_SIZE)) != SPI_FLASH_RESULT_OK) {
+				return false;
+			}
+			sector += (BLOCK_SIZE / SECTOR_SIZE);
+			continue;
+		}
+#endif
+		if (spi_flash_erase_sector(sector) != SPI_FLASH_RESULT_OK) {
+			return false;
+		}
+		sector++;
+	}
+	return true;
+}
+
+// set up a write status struct, without touching the config
+static void ICACHE_FLASH_ATTR write_setup(rboot_write_status *status, uint32_t start_addr) {
+	memset(status, 0, sizeof(rboot_write_status));
+#ifdef BOOT_ROM_DIGEST
+	status->origin = start_addr;
+#endif
+#ifdef BOOT_OTA_STATS
+	status->stats.start_time = system_get_time();
+	status->stats.heap_free_min = system_get_free_heap_size();
+#endif
+	status->start_addr = start_addr;
+	status->start_sector = start_addr / SECTOR_SIZE;
+	status->last_sector_erased = status->start_sector - 1;
+	//status->max_sector_count = 200;
+	//os_printf("init addr: 0x%08x\r\n", start_addr);
+}
+
 // create the write status struct, based on supplied start address
 rboot_write_status ICACHE_FLASH_ATTR rboot_write_init(uint32_t start_addr) {
-	rboot_write_status status = {0};
-	status.start_addr = start_addr;
-	status.start_sector = start_addr / SECTOR_SIZE;
-	status.last_sector_erased = status.start_sector - 1;
-	//status.max_sector_count = 200;
-	//os_printf("init addr: 0x%08x\r\n", start_addr);
+	rboot_write_status status;
+#if defined(BOOT_SIGNATURE) || defined(BOOT_ROM_DIGEST)
+	invalidate_rom(start_addr);
+#endif
+	write_setup(&status, start_addr);
 	return status;
 }
 
-// ensure any remaning bytes get written (needed for files not a multiple of 4 bytes)
-bool ICACHE_FLASH_ATTR rboot_write_end(rboot_write_status *status) {
+// erase the whole area to be written in one go, rather than a sector
+// at a time as the data arrives, so block erases can be used
+bool ICACHE_FLASH_ATTR rboot_write_erase(rboot_write_status *status, uint32_t len) {
+	int32_t lastsect = ((status->start_addr + len) - 1) / SECTOR_SIZE;
+	uint32_t addr = (status->last_sector_erased + 1) * SECTOR_SIZE;
+#ifdef BOOT_OTA_STATS
+	uint32_t time = system_get_time();
+#endif
+
+	if (len == 0 || lastsect <= status->last_sector_erased) {
+		return true;
+	}
+	if (!rboot_erase_flash(addr, ((lastsect + 1) * SECTOR_SIZE) - addr)) {
+		return false;
+	}
+#ifdef BOOT_OTA_STATS
+	status->stats.erase_us += system_get_time() - time;
+	status->stats.sectors_erased += lastsect - status->last_sector_erased;
+#endif
+	status->last_sector_erased = lastsect;
+	return true;
+}
+
+// write out any bytes left over from the last call
+static bool ICACHE_FLASH_ATTR write_flush(rboot_write_status *status) {
 	uint8_t i;
 	if (status->extra_count != 0) {
 		for (i = status->extra_count; i < 4; i++) {
@@ -101,6 +348,21 @@ bool ICACHE_FLASH_ATTR rboot_write_end(rboot_write_status *status) {
 	return true;
 }
 
+// ensure any remaning bytes get written (needed for files not a multiple of 4 bytes)
+bool ICACHE_FLASH_ATTR rboot_write_end(rboot_write_status *status) {
+	bool ret;
+#ifdef BOOT_ROM_DIGEST
+	uint32_t length = status->length;
+#endif
+	ret = write_flush(status);
+#ifdef BOOT_ROM_DIGEST
+	if (ret) {
+		ret = record_digest(status->origin, length);
+	}
+#endif
+	return ret;
+}
+
 // function to do the actual writing to flash
 // call repeatedly with more data (max len per write is the flash sector size (4k))
 bool ICACHE_FLASH_ATTR rboot_write_flash(rboot_write_status *status, uint8_t *data, uint16_t len) {
@@ -108,10 +370,17 @@ bool ICACHE_FLASH_ATTR rboot_write_flash(rboot_write_status *status, uint8_t *da
 	bool ret = false;
 	uint8_t *buffer;
 	int32_t lastsect;
+#ifdef BOOT_OTA_STATS
+	uint32_t start = system_get_time();
+	uint32_t time;
+#endif
 	
 	if (data == NULL || len == 0) {
 		return true;
 	}
+#ifdef BOOT_ROM_DIGEST
+	status->length += len;
+#endif
 	
 	// get a buffer
 	buffer = (uint8_t *)pvPortMalloc(len + status->extra_count, 0, 0);
@@ -119,6 +388,9 @@ bool ICACHE_FLASH_ATTR rboot_write_flash(rboot_write_status *status, uint8_t *da
 		//os_printf("No ram!\r\n");
 		return false;
 	}
+#ifdef BOOT_OTA_STATS
+	stats_heap(&status->stats, len + status->extra_count);
+#endif
 
 	// copy in any remaining bytes from last chunk
 	if (status->extra_count != 0) {
@@ -139,10 +411,27 @@ bool ICACHE_FLASH_ATTR rboot_write_flash(rboot_write_status *status, uint8_t *da
 
 		// erase any additional sectors needed by this chunk
 		lastsect = ((status->start_addr + len) - 1) / SECTOR_SIZE;
+#ifdef BOOT_READ_CACHE
+		if (lastsect > status->last_sector_erased) {
+			rboot_cache_invalidate((status->last_sector_erased + 1) * SECTOR_SIZE,
+				(lastsect - status->last_sector_erased) * SECTOR_SIZE);
+		}
+		rboot_cache_invalidate(status->start_addr, len);
+#endif
+#ifdef BOOT_OTA_STATS
+		time = system_get_time();
+		if (lastsect > status->last_sector_erased) {
+			status->stats.sectors_erased += lastsect - status->last_sector_erased;
+		}
+#endif
 		while (lastsect > status->last_sector_erased) {
 			status->last_sector_erased++;
 			spi_flash_erase_sector(status->last_sector_erased);
 		}
+#ifdef BOOT_OTA_STATS
+		status->stats.erase_us += system_get_time() - time;
+		time = system_get_time();
+#endif
 
 		// write current chunk
 		//os_printf("write addr: 0x%08x, len: 0x%04x\r\n", status->start_addr, len);
@@ -150,59 +439,1388 @@ bool ICACHE_FLASH_ATTR rboot_write_flash(rboot_write_status *status, uint8_t *da
 			ret = true;
 			status->start_addr += len;
 		}
+#ifdef BOOT_OTA_STATS
+		status->stats.program_us += system_get_time() - time;
+		if (ret) status->stats.bytes += len;
+#endif
 	//}
 
 	vPortFree(buffer, 0, 0);
+#ifdef BOOT_OTA_STATS
+	stats_call(&status->stats, system_get_time() - start);
+#endif
 	return ret;
 }
 
-#ifdef BOOT_RTC_ENABLED
-bool ICACHE_FLASH_ATTR rboot_get_rtc_data(rboot_rtc_data *rtc) {
-	if (system_rtc_mem_read(RBOOT_RTC_ADDR, rtc, sizeof(rboot_rtc_data))) {
-		return (rtc->chksum == calc_chksum((uint8_t*)rtc, (uint8_t*)&rtc->chksum));
+#ifdef BOOT_OTA_STATS
+void ICACHE_FLASH_ATTR rboot_write_get_stats(rboot_write_status *status, rboot_write_stats *stats) {
+	*stats = status->stats;
+	stats->elapsed_us = system_get_time() - status->stats.start_time;
+}
+#endif
+
+#ifdef BOOT_READ_CACHE
+// tag of an empty line, never line aligned
+#define CACHE_EMPTY 0xffffffff
+
+typedef struct {
+	uint32_t addr;
+	uint32_t used;
+} cache_tag;
+
+static struct {
+	uint8_t *data;
+	cache_tag *tags;
+	uint32_t lines;
+	uint32_t clock;
+	uint32_t next;
+	rboot_cache_stats stats;
+} cache;
+
+bool ICACHE_FLASH_ATTR rboot_cache_init(uint32_t budget) {
+	uint32_t lines = budget / (RBOOT_CACHE_LINE + sizeof(cache_tag));
+	uint32_t loop;
+
+	rboot_cache_free();
+	if (lines == 0) {
+		return false;
 	}
-	return false;
+	// lines then tags, in one allocation
+	cache.data = (uint8_t*)pvPortMalloc(lines * (RBOOT_CACHE_LINE + sizeof(cache_tag)), 0, 0);
+	if (!cache.data) {
+		return false;
+	}
+	cache.tags = (cache_tag*)(cache.data + (lines * RBOOT_CACHE_LINE));
+	for (loop = 0; loop < lines; loop++) {
+		cache.tags[loop].addr = CACHE_EMPTY;
+		cache.tags[loop].used = 0;
+	}
+	cache.lines = lines;
+	return true;
 }
 
-bool ICACHE_FLASH_ATTR rboot_set_rtc_data(rboot_rtc_data *rtc) {
-	// calculate checksum
-	rtc->chksum = calc_chksum((uint8_t*)rtc, (uint8_t*)&rtc->chksum);
-	return system_rtc_mem_write(RBOOT_RTC_ADDR, rtc, sizeof(rboot_rtc_data));
+void ICACHE_FLASH_ATTR rboot_cache_free(void) {
+	if (cache.data) {
+		vPortFree(cache.data, 0, 0);
+	}
+	memset(&cache, 0, sizeof(cache));
+	cache.next = CACHE_EMPTY;
 }
 
-bool ICACHE_FLASH_ATTR rboot_set_temp_rom(uint8_t rom) {
-	rboot_rtc_data rtc;
-	// invalid data in rtc?
-	if (!rboot_get_rtc_data(&rtc)) {
-		// set basics
-		rtc.magic = RBOOT_RTC_MAGIC;
-		rtc.last_mode = MODE_STANDARD;
-		rtc.last_rom = 0;
+static int32_t ICACHE_FLASH_ATTR cache_find(uint32_t addr) {
+	uint32_t loop;
+	for (loop = 0; loop < cache.lines; loop++) {
+		if (cache.tags[loop].addr == addr) return loop;
 	}
-	// set next boot to temp mode with specified rom
-	rtc.next_mode = MODE_TEMP_ROM;
-	rtc.temp_rom = rom;
+	return -1;
+}
 
-	return rboot_set_rtc_data(&rtc);
+// read a missing line (and, following on from the last miss, the
+// lines after it) into the least recently used run of lines
+static int32_t ICACHE_FLASH_ATTR cache_fill(uint32_t addr) {
+	uint32_t count = 1;
+	uint32_t best = 0;
+	uint32_t oldest = CACHE_EMPTY;
+	uint32_t newest;
+	uint32_t loop;
+	uint32_t run;
+	int32_t found;
+
+	if (addr == cache.next) {
+		// leave at least half the cache alone
+		count += RBOOT_CACHE_AHEAD;
+		if (count > cache.lines / 2) count = (cache.lines > 1) ? cache.lines / 2 : 1;
+	}
+	for (loop = 0; loop + count <= cache.lines; loop++) {
+		newest = 0;
+		for (run = 0; run < count; run++) {
+			if (cache.tags[loop + run].used > newest) newest = cache.tags[loop + run].used;
+		}
+		if (newest < oldest) {
+			oldest = newest;
+			best = loop;
+		}
+	}
+	// no other copies of the lines read ahead
+	for (run = 1; run < count; run++) {
+		found = cache_find(addr + (run * RBOOT_CACHE_LINE));
+		if (found >= 0) cache.tags[found].addr = CACHE_EMPTY;
+	}
+	for (run = 0; run < count; run++) {
+		cache.tags[best + run].addr = CACHE_EMPTY;
+	}
+
+	while (1) {
+		cache.stats.flash_reads++;
+		if (spi_flash_read(addr, (uint32_t*)((void*)(cache.data + (best * RBOOT_CACHE_LINE))),
+			count * RBOOT_CACHE_LINE) == SPI_FLASH_RESULT_OK) {
+			break;
+		}
+		// reading ahead may have run off the end of the flash
+		if (count == 1) return -1;
+		count = 1;
+	}
+
+	for (run = 0; run < count; run++) {
+		cache.tags[best + run].addr = addr + (run * RBOOT_CACHE_LINE);
+		cache.tags[best + run].used = cache.clock;
+	}
+	cache.next = addr + (count * RBOOT_CACHE_LINE);
+	cache.stats.misses++;
+	cache.stats.ahead += count - 1;
+	return best;
 }
 
-bool ICACHE_FLASH_ATTR rboot_get_last_boot_rom(uint8_t *rom) {
-	rboot_rtc_data rtc;
-	if (rboot_get_rtc_data(&rtc)) {
-		*rom = rtc.last_rom;
-		return true;
+bool ICACHE_FLASH_ATTR rboot_cache_read(uint32_t addr, void *data, uint32_t len) {
+	uint32_t line;
+	uint32_t offset;
+	uint32_t chunk;
+	int32_t slot;
+
+	if (!cache.data) {
+		return false;
 	}
-	return false;
+	while (len > 0) {
+		line = addr & ~(RBOOT_CACHE_LINE - 1);
+		offset = addr - line;
+		chunk = RBOOT_CACHE_LINE - offset;
+		if (chunk > len) chunk = len;
+
+		slot = cache_find(line);
+		if (slot >= 0) {
+			cache.stats.hits++;
+		} else if ((slot = cache_fill(line)) < 0) {
+			return false;
+		}
+		cache.tags[slot].used = ++cache.clock;
+		memcpy(data, cache.data + (slot * RBOOT_CACHE_LINE) + offset, chunk);
+
+		data = (uint8_t*)data + chunk;
+		addr += chunk;
+		len -= chunk;
+	}
+	return true;
 }
 
-bool ICACHE_FLASH_ATTR rboot_get_last_boot_mode(uint8_t *mode) {
-	rboot_rtc_data rtc;
-	if (rboot_get_rtc_data(&rtc)) {
-		*mode = rtc.last_mode;
+void ICACHE_FLASH_ATTR rboot_cache_invalidate(uint32_t addr, uint32_t len) {
+	uint32_t loop;
+	uint32_t line;
+
+	for (loop = 0; loop < cache.lines && len > 0; loop++) {
+		line = cache.tags[loop].addr;
+		if (line != CACHE_EMPTY && line < addr + len && line + RBOOT_CACHE_LINE > addr) {
+			cache.tags[loop].addr = CACHE_EMPTY;
+			cache.tags[loop].used = 0;
+			cache.stats.invalidated++;
+		}
+	}
+}
+
+void ICACHE_FLASH_ATTR rboot_cache_get_stats(rboot_cache_stats *stats) {
+	*stats = cache.stats;
+}
+#endif
+
+#ifdef BOOT_OTA_PIPE
+// head and tail are each only written by one side, on a single core this
+// is enough to stop the buffer accesses being moved past them
+#define pipe_barrier() __asm__ __volatile__("" ::: "memory")
+
+bool ICACHE_FLASH_ATTR rboot_pipe_init(rboot_pipe *pipe, uint32_t start_addr, uint8_t *buffer, uint32_t size,
+	rboot_pipe_notify writer, rboot_pipe_notify producer, void *arg) {
+	if (!buffer || size < RBOOT_PIPE_PAGE || (size & (size - 1))) {
+		return false;
+	}
+	memset(pipe, 0, sizeof(rboot_pipe));
+	pipe->buffer = buffer;
+	pipe->size = size;
+	pipe->writer = writer;
+	pipe->producer = producer;
+	pipe->arg = arg;
+	pipe->write = rboot_write_init(start_addr);
+	return true;
+}
+
+// copy as much as fits into the ring
+static uint32_t ICACHE_FLASH_ATTR pipe_copy_in(rboot_pipe *pipe, const uint8_t *data, uint32_t len) {
+	uint32_t head = pipe->head;
+	uint32_t space = pipe->size - (head - pipe->tail);
+	uint32_t pos = head & (pipe->size - 1);
+	uint32_t first;
+
+	if (len > space) len = space;
+	first = pipe->size - pos;
+	if (first > len) first = len;
+	memcpy(pipe->buffer + pos, data, first);
+	memcpy(pipe->buffer, data + first, len - first);
+	pipe_barrier();
+	pipe->head = head + len;
+	return len;
+}
+
+uint32_t ICACHE_FLASH_ATTR rboot_pipe_push(rboot_pipe *pipe, const uint8_t *data, uint32_t len) {
+	uint32_t done;
+
+	if (pipe->closed || pipe->result != RBOOT_PIPE_RUNNING) {
+		return 0;
+	}
+	done = pipe_copy_in(pipe, data, len);
+	if (done < len) {
+		// ask to be woken when there is space, then look again in case
+		// the writer freed some before it could see the request
+		pipe->waiting = 1;
+		pipe_barrier();
+		done += pipe_copy_in(pipe, data + done, len - done);
+	}
+	if (pipe->head - pipe->tail >= RBOOT_PIPE_PAGE && pipe->writer) {
+		pipe->writer(pipe->arg);
+	}
+	return done;
+}
+
+bool ICACHE_FLASH_ATTR rboot_pipe_close(rboot_pipe *pipe) {
+	pipe_barrier();
+	pipe->closed = 1;
+	if (pipe->writer) {
+		pipe->writer(pipe->arg);
+	}
+	return (pipe->result != RBOOT_PIPE_ERROR);
+}
+
+static void ICACHE_FLASH_ATTR pipe_finish(rboot_pipe *pipe, uint8_t result) {
+	pipe->result = result;
+	if (pipe->producer) {
+		pipe->producer(pipe->arg);
+	}
+}
+
+bool ICACHE_FLASH_ATTR rboot_pipe_service(rboot_pipe *pipe) {
+	uint32_t tail;
+	uint32_t pos;
+	uint32_t len;
+	uint8_t closed;
+
+	if (pipe->result != RBOOT_PIPE_RUNNING) {
+		return (pipe->result == RBOOT_PIPE_DONE);
+	}
+	for (;;) {
+		// closed must be read before head, so nothing pushed before the
+		// close is missed
+		closed = pipe->closed;
+		pipe_barrier();
+		tail = pipe->tail;
+		pos = tail & (pipe->size - 1);
+		// whole pages, up to a sector and the end of the ring
+		len = pipe->size - pos;
+		if (len > pipe->head - tail) len = pipe->head - tail;
+		if (len > SECTOR_SIZE) len = SECTOR_SIZE;
+		if (!closed) len &= ~(RBOOT_PIPE_PAGE - 1);
+		if (len == 0) break;
+
+		if (!rboot_write_flash(&pipe->write, pipe->buffer + pos, len)) {
+			pipe_finish(pipe, RBOOT_PIPE_ERROR);
+			return false;
+		}
+		pipe_barrier();
+		pipe->tail = tail + len;
+		pipe_barrier();
+		if (pipe->waiting) {
+			pipe->waiting = 0;
+			if (pipe->producer) {
+				pipe->producer(pipe->arg);
+			}
+		}
+	}
+
+	if (closed) {
+		pipe_finish(pipe, rboot_write_end(&pipe->write) ? RBOOT_PIPE_DONE : RBOOT_PIPE_ERROR);
+		return (pipe->result == RBOOT_PIPE_DONE);
+	}
+	return true;
+}
+#endif
+
+// header at the start of the chunk writer state sector,
+// followed by the received page bitmap
+typedef struct {
+	uint32_t magic;
+	uint32_t start_addr;
+	uint32_t length;
+	uint32_t page_size;
+	uint32_t image_id;
+} rboot_chunk_header;
+
+#define CHUNK_STATE_ADDR(status) ((status)->state_sector * SECTOR_SIZE)
+#define CHUNK_BITMAP_ADDR(status) (CHUNK_STATE_ADDR(status) + sizeof(rboot_chunk_header))
+
+// bitmap bits start as 1 (erased flash) and are cleared as pages
+// arrive, so the saved copy can be updated without an erase
+static bool ICACHE_FLASH_ATTR chunk_received(rboot_chunk_status *status, uint32_t page) {
+	return (status->bitmap[page / 32] & (1u << (page % 32))) == 0;
+}
+
+// set up an out of order write, resuming a previous one if the state
+// sector holds the state of a write of the same image (same place, length
+// and id, a different release of the same length must start again)
+bool ICACHE_FLASH_ATTR rboot_chunk_init(rboot_chunk_status *status, uint32_t start_addr, uint32_t len, uint32_t image_id, uint32_t state_sector) {
+	rboot_chunk_header header;
+	uint32_t words;
+	uint32_t page;
+
+	memset(status, 0, sizeof(rboot_chunk_status));
+	status->start_addr = start_addr;
+	status->length = len;
+	status->state_sector = state_sector;
+	status->pages = (len + RBOOT_CHUNK_PAGE - 1) / RBOOT_CHUNK_PAGE;
+	status->dirty_lo = 0xffff;
+
+	// must start on a sector and bitmap must fit in the state sector
+	words = (status->pages + 31) / 32;
+	if ((start_addr % SECTOR_SIZE) != 0 || len == 0 ||
+		sizeof(rboot_chunk_header) + (words * 4) > SECTOR_SIZE) {
+		return false;
+	}
+
+	status->bitmap = (uint32_t*)pvPortMalloc(words * 4, 0, 0);
+	if (!status->bitmap) {
+		//os_printf("No ram!\r\n");
+		return false;
+	}
+
+	spi_flash_read(CHUNK_STATE_ADDR(status), (uint32_t*)((void*)&header), sizeof(rboot_chunk_header));
+	if (header.magic == RBOOT_CHUNK_MAGIC && header.start_addr == start_addr &&
+		header.length == len && header.page_size == RBOOT_CHUNK_PAGE && header.image_id == image_id &&
+		spi_flash_read(CHUNK_BITMAP_ADDR(status), status->bitmap, words * 4) == SPI_FLASH_RESULT_OK) {
+		// resume, count the pages we already have
+		for (page = 0; page < status->pages; page++) {
+			if (chunk_received(status, page)) status->received++;
+		}
 		return true;
 	}
-	return false;
+
+	// new write, start with an empty bitmap
+#if defined(BOOT_SIGNATURE) || defined(BOOT_ROM_DIGEST)
+	invalidate_rom(start_addr);
+#endif
+	memset(status->bitmap, 0xff, words * 4);
+	header.magic = RBOOT_CHUNK_MAGIC;
+	header.start_addr = start_addr;
+	header.length = len;
+	header.page_size = RBOOT_CHUNK_PAGE;
+	header.image_id = image_id;
+#ifdef BOOT_READ_CACHE
+	rboot_cache_invalidate(CHUNK_STATE_ADDR(status), SECTOR_SIZE);
+#endif
+	if (spi_flash_erase_sector(state_sector) != SPI_FLASH_RESULT_OK ||
+		spi_flash_write(CHUNK_STATE_ADDR(status), (uint32_t*)((void*)&header), sizeof(rboot_chunk_header)) != SPI_FLASH_RESULT_OK) {
+		vPortFree(status->bitmap, 0, 0);
+		status->bitmap = NULL;
+		return false;
+	}
+	return true;
+}
+
+// write the changed part of the received page bitmap to the state sector
+bool ICACHE_FLASH_ATTR rboot_chunk_save(rboot_chunk_status *status) {
+	uint32_t lo = status->dirty_lo;
+	uint32_t hi = status->dirty_hi;
+
+	if (status->bitmap == NULL) return false;
+	if (lo > hi) return true;
+#ifdef BOOT_READ_CACHE
+	rboot_cache_invalidate(CHUNK_BITMAP_ADDR(status) + (lo * 4), (hi - lo + 1) * 4);
+#endif
+	if (spi_flash_write(CHUNK_BITMAP_ADDR(status) + (lo * 4), status->bitmap + lo, (hi - lo + 1) * 4) != SPI_FLASH_RESULT_OK) {
+		return false;
+	}
+	status->dirty_lo = 0xffff;
+	status->dirty_hi = 0;
+	status->unsaved = 0;
+	return true;
 }
+
+// write a chunk of the image at any offset, offset must be a multiple of
+// RBOOT_CHUNK_PAGE and so must len, unless the chunk ends the image
+bool ICACHE_FLASH_ATTR rboot_chunk_write(rboot_chunk_status *status, uint32_t offset, uint8_t *data, uint32_t len) {
+	uint32_t buffer[RBOOT_CHUNK_PAGE / 4];
+	uint32_t page;
+	uint32_t first;
+	uint32_t sector;
+	uint32_t pagelen;
+
+	if (status->bitmap == NULL || (offset % RBOOT_CHUNK_PAGE) != 0 || offset + len > status->length ||
+		((len % RBOOT_CHUNK_PAGE) != 0 && offset + len != status->length)) {
+		return false;
+	}
+#ifdef BOOT_READ_CACHE
+	// whole sectors, as a page's sector may be erased
+	sector = (status->start_addr + offset) & ~(SECTOR_SIZE - 1);
+	rboot_cache_invalidate(sector, ((status->start_addr + offset + len + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1)) - sector);
+#endif
+
+	for (page = offset / RBOOT_CHUNK_PAGE; len > 0; page++) {
+		pagelen = (len < RBOOT_CHUNK_PAGE) ? len : RBOOT_CHUNK_PAGE;
+		if (!chunk_received(status, page)) {
+
+			// erase the sector on first touch, i.e. if we have no other pages from it
+			sector = (page * RBOOT_CHUNK_PAGE) / SECTOR_SIZE;
+			first = sector * (SECTOR_SIZE / RBOOT_CHUNK_PAGE);
+			while (first < status->pages && first < (sector + 1) * (SECTOR_SIZE / RBOOT_CHUNK_PAGE) &&
+				!chunk_received(status, first)) {
+				first++;
+			}
+			if (first == status->pages || first == (sector + 1) * (SECTOR_SIZE / RBOOT_CHUNK_PAGE)) {
+				if (spi_flash_erase_sector((status->start_addr / SECTOR_SIZE) + sector) != SPI_FLASH_RESULT_OK) {
+					return false;
+				}
+			}
+
+			// copy to an aligned buffer, padding a short final page
+			memcpy(buffer, data, pagelen);
+			memset((uint8_t*)buffer + pagelen, 0xff, sizeof(buffer) - pagelen);
+			if (spi_flash_write(status->start_addr + (page * RBOOT_CHUNK_PAGE), buffer, (pagelen + 3) & ~3) != SPI_FLASH_RESULT_OK) {
+				return false;
+			}
+
+			status->bitmap[page / 32] &= ~(1u << (page % 32));
+			if (page / 32 < status->dirty_lo) status->dirty_lo = page / 32;
+			if (page / 32 > status->dirty_hi) status->dirty_hi = page / 32;
+			status->received++;
+			status->unsaved++;
+		}
+		data += pagelen;
+		len -= pagelen;
+	}
+
+	// persist progress periodically
+	if (status->unsaved >= RBOOT_CHUNK_SAVE_PAGES) {
+		return rboot_chunk_save(status);
+	}
+	return true;
+}
+
+// find the first missing part of the image at or after offset
+uint32_t ICACHE_FLASH_ATTR rboot_chunk_missing(rboot_chunk_status *status, uint32_t offset) {
+	uint32_t page;
+	for (page = offset / RBOOT_CHUNK_PAGE; page < status->pages; page++) {
+		if (!chunk_received(status, page)) {
+			return page * RBOOT_CHUNK_PAGE;
+		}
+	}
+	return status->length;
+}
+
+// finish (or suspend) an out of order write
+bool ICACHE_FLASH_ATTR rboot_chunk_end(rboot_chunk_status *status) {
+	bool complete;
+
+	if (status->bitmap == NULL) return false;
+	complete = (status->received == status->pages);
+	if (complete) {
+		// done, clear the state so the next write starts afresh
+#ifdef BOOT_READ_CACHE
+		rboot_cache_invalidate(CHUNK_STATE_ADDR(status), SECTOR_SIZE);
+#endif
+		spi_flash_erase_sector(status->state_sector);
+#ifdef BOOT_ROM_DIGEST
+		complete = record_digest(status->start_addr, status->length);
+#endif
+	} else {
+		rboot_chunk_save(status);
+	}
+	vPortFree(status->bitmap, 0, 0);
+	status->bitmap = NULL;
+	return complete;
+}
+
+// size of the flash, from the size field of rBoot's own header
+static uint32_t ICACHE_FLASH_ATTR flash_size(void) {
+	uint32_t header;
+	if (spi_flash_read(0, &header, sizeof(header)) != SPI_FLASH_RESULT_OK) {
+		return 0;
+	}
+	switch ((header >> 28) & 0x0f) {
+		case 0: return 0x80000;
+		case 1: return 0x40000;
+		case 2: return 0x100000;
+		case 3: case 5: return 0x200000;
+		case 4: case 6: return 0x400000;
+		case 8: return 0x800000;
+		case 9: return 0x1000000;
+	}
+	return 0;
+}
+
+// end of a rom slot, the start of the next slot or the end of its 1MB
+// mapping segment, whichever comes first
+static uint32_t ICACHE_FLASH_ATTR slot_end(rboot_config *conf, uint8_t rom) {
+	uint32_t start = conf->roms[rom];
+	uint32_t end = (start & ~0xfffff) + 0x100000;
+	uint8_t loop;
+
+	for (loop = 0; loop < conf->count; loop++) {
+		if (conf->roms[loop] > start && conf->roms[loop] < end) {
+			end = conf->roms[loop];
+		}
+	}
+	return end;
+}
+
+// set up a copy of one rom slot to another
+bool ICACHE_FLASH_ATTR rboot_copy_init(rboot_copy_status *status, uint8_t src_rom, uint8_t dst_rom, uint32_t len) {
+	rboot_config conf;
+	uint32_t flash;
+	uint32_t run_start;
+	uint32_t run_end;
+
+	memset(status, 0, sizeof(rboot_copy_status));
+	conf = rboot_get_config();
+	if (src_rom >= conf.count || dst_rom >= conf.count || src_rom == dst_rom) {
+		return false;
+	}
+	if (len == 0) {
+		len = rboot_get_rom_length(conf.roms[src_rom]);
+		if (len == 0) return false;
+	}
+
+	flash = flash_size();
+	if (flash == 0 || len > flash || conf.current_rom >= conf.count) {
+		return false;
+	}
+
+	status->src_rom = src_rom;
+	status->dst_rom = dst_rom;
+	status->src_addr = conf.roms[src_rom];
+	status->dst_addr = conf.roms[dst_rom];
+	// whole sectors, so anything appended to the image comes too
+	status->length = (len + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+	if ((status->src_addr < status->dst_addr && status->src_addr + status->length > status->dst_addr) ||
+		(status->dst_addr < status->src_addr && status->dst_addr + status->length > status->src_addr)) {
+		return false;
+	}
+	// both on the flash, and the copy must fit in the destination slot,
+	// after rBoot's config and clear of the running rom
+	run_start = conf.roms[conf.current_rom];
+	run_end = slot_end(&conf, conf.current_rom);
+	if (status->src_addr >= flash || status->length > flash - status->src_addr ||
+		status->dst_addr >= flash || status->length > flash - status->dst_addr ||
+		status->dst_addr < SECTOR_SIZE * (BOOT_CONFIG_SECTOR + 1) ||
+		status->length > slot_end(&conf, dst_rom) - status->dst_addr ||
+		(status->dst_addr < run_end && run_start < status->dst_addr + status->length)) {
+		return false;
+	}
+
+#if defined(BOOT_SIGNATURE) || defined(BOOT_ROM_DIGEST)
+	invalidate_rom(status->dst_addr);
+#endif
+	return true;
+}
+
+// the copy is complete, the destination now has the same
+// contents as the source so inherit its digest and attestation
+static bool ICACHE_FLASH_ATTR copy_end(rboot_copy_status *status) {
+#if defined(BOOT_SIGNATURE) || defined(BOOT_ROM_DIGEST)
+	rboot_config conf;
+	conf = rboot_get_config();
+#ifdef BOOT_ROM_DIGEST
+	memcpy(conf.digest[status->dst_rom], conf.digest[status->src_rom], RBOOT_DIGEST_LEN);
+#endif
+#ifdef BOOT_SIGNATURE
+	if (conf.generation[status->src_rom] != 0 &&
+		conf.attest[status->src_rom].rom == status->src_rom &&
+		conf.attest[status->src_rom].generation == conf.generation[status->src_rom]) {
+		conf.attest[status->dst_rom] = conf.attest[status->src_rom];
+		conf.attest[status->dst_rom].rom = status->dst_rom;
+		conf.attest[status->dst_rom].generation = conf.generation[status->dst_rom];
+	}
+#endif
+	return rboot_set_config(&conf);
+#else
+	return true;
+#endif
+}
+
+// copy the next sector, skipping it if the destination already matches
+bool ICACHE_FLASH_ATTR rboot_copy_step(rboot_copy_status *status) {
+	uint32_t src[RBOOT_COPY_CHUNK / 4];
+	uint32_t dst[RBOOT_COPY_CHUNK / 4];
+	uint32_t src_addr;
+	uint32_t dst_addr;
+	uint32_t pos;
+	uint8_t loop;
+	bool match = true;
+	bool blank = true;
+
+	if (status->done >= status->length) {
+		return true;
+	}
+	src_addr = status->src_addr + status->done;
+	dst_addr = status->dst_addr + status->done;
+
+	// compare the sector, noting if the destination is already erased
+	for (pos = 0; pos < SECTOR_SIZE && (match || blank); pos += sizeof(src)) {
+		if (spi_flash_read(src_addr + pos, src, sizeof(src)) != SPI_FLASH_RESULT_OK ||
+			spi_flash_read(dst_addr + pos, dst, sizeof(dst)) != SPI_FLASH_RESULT_OK) {
+			return false;
+		}
+		for (loop = 0; loop < sizeof(src) / 4; loop++) {
+			if (src[loop] != dst[loop]) match = false;
+			if (dst[loop] != 0xffffffff) blank = false;
+		}
+	}
+
+	if (match) {
+		status->skipped++;
+	} else {
+#ifdef BOOT_READ_CACHE
+		rboot_cache_invalidate(dst_addr, SECTOR_SIZE);
+#endif
+		if (!blank && spi_flash_erase_sector(dst_addr / SECTOR_SIZE) != SPI_FLASH_RESULT_OK) {
+			return false;
+		}
+		// copy, verifying each chunk as we go
+		for (pos = 0; pos < SECTOR_SIZE; pos += sizeof(src)) {
+			if (spi_flash_read(src_addr + pos, src, sizeof(src)) != SPI_FLASH_RESULT_OK ||
+				spi_flash_write(dst_addr + pos, src, sizeof(src)) != SPI_FLASH_RESULT_OK ||
+				spi_flash_read(dst_addr + pos, dst, sizeof(dst)) != SPI_FLASH_RESULT_OK) {
+				return false;
+			}
+			for (loop = 0; loop < sizeof(src) / 4; loop++) {
+				if (src[loop] != dst[loop]) return false;
+			}
+		}
+		status->copied++;
+	}
+
+	status->done += SECTOR_SIZE;
+	if (status->done >= status->length) {
+		return copy_end(status);
+	}
+	return true;
+}
+
+#ifdef BOOT_OVERLAY
+// the overlay currently in the iram window
+static struct {
+	uint32_t addr;
+	uint8_t id;
+	bool loaded;
+} overlay;
+
+// load one section of an overlay image into the iram window, the whole
+// image is read so the checksum can be checked, as rBoot does at boot
+bool ICACHE_FLASH_ATTR rboot_load_overlay(uint32_t addr, uint8_t id) {
+	uint32_t buffer[RBOOT_COPY_CHUNK / 4];
+	uint32_t header[2];
+	uint8_t *magic = (uint8_t*)header;
+	uint32_t readpos = addr;
+	uint32_t *writepos;
+	uint32_t remaining;
+	uint32_t loop;
+	uint8_t count;
+	uint8_t current;
+	uint8_t chksum = CHKSUM_INIT;
+	bool found = false;
+
+	if (overlay.loaded && overlay.addr == addr && overlay.id == id) {
+		return true;
+	}
+	// the window is about to be overwritten
+	overlay.loaded = false;
+
+	if (spi_flash_read(readpos, header, sizeof(header)) != SPI_FLASH_RESULT_OK ||
+		magic[0] != ROM_MAGIC || id >= magic[1]) {
+		return false;
+	}
+	count = magic[1];
+	readpos += sizeof(header);
+
+	for (current = 0; current < count; current++) {
+		// header is load address and length
+		if (spi_flash_read(readpos, header, sizeof(header)) != SPI_FLASH_RESULT_OK) {
+			return false;
+		}
+		readpos += sizeof(header);
+		remaining = header[1];
+		writepos = NULL;
+		// sections are padded to whole words
+		if ((remaining & 3) || remaining > 0x100000) {
+			return false;
+		}
+		if (current == id) {
+			// must fit the window, iram only takes 32 bit writes
+			if (header[0] < RBOOT_OVERLAY_ADDR || (header[0] & 3) ||
+				remaining > RBOOT_OVERLAY_LEN - (header[0] - RBOOT_OVERLAY_ADDR)) {
+				return false;
+			}
+			writepos = (uint32_t*)header[0];
+			found = true;
+		}
+
+		while (remaining > 0) {
+			uint32_t readlen = (remaining < sizeof(buffer)) ? remaining : sizeof(buffer);
+			if (spi_flash_read(readpos, buffer, readlen) != SPI_FLASH_RESULT_OK) {
+				return false;
+			}
+			readpos += readlen;
+			remaining -= readlen;
+			for (loop = 0; loop < readlen; loop++) {
+				chksum ^= ((uint8_t*)buffer)[loop];
+			}
+			if (writepos) {
+				for (loop = 0; loop < readlen / 4; loop++) {
+					*writepos++ = buffer[loop];
+				}
+			}
+		}
+	}
+
+	// checksum is the last byte of the 16 byte block
+	if (!found || spi_flash_read(readpos & ~0x0f, buffer, 16) != SPI_FLASH_RESULT_OK ||
+		((uint8_t*)buffer)[15] != chksum) {
+		return false;
+	}
+
+	overlay.addr = addr;
+	overlay.id = id;
+	overlay.loaded = true;
+	return true;
+}
+
+// find which overlay is resident
+bool ICACHE_FLASH_ATTR rboot_get_overlay(uint32_t *addr, uint8_t *id) {
+	if (!overlay.loaded) {
+		return false;
+	}
+	*addr = overlay.addr;
+	*id = overlay.id;
+	return true;
+}
+
+// forget the resident overlay, e.g. before using the window for something else
+void ICACHE_FLASH_ATTR rboot_unload_overlay(void) {
+	overlay.loaded = false;
+}
+#endif
+
+#ifdef BOOT_MANIFEST
+static const uint32_t crc_table[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+// standard (ieee) crc32, a nibble at a time to keep the table small
+static uint32_t ICACHE_FLASH_ATTR crc32_update(uint32_t crc, const uint8_t *data, uint32_t len) {
+	while (len--) {
+		crc ^= *data++;
+		crc = (crc >> 4) ^ crc_table[crc & 0x0f];
+		crc = (crc >> 4) ^ crc_table[crc & 0x0f];
+	}
+	return crc;
+}
+
+// crc32 of an area of flash
+static bool ICACHE_FLASH_ATTR crc_flash(uint32_t addr, uint32_t len, uint32_t *crc) {
+	uint32_t buffer[RBOOT_COPY_CHUNK / 4];
+	uint32_t readlen;
+
+	*crc = 0xffffffff;
+	while (len > 0) {
+		readlen = (len < sizeof(buffer)) ? len : sizeof(buffer);
+		if (spi_flash_read(addr, buffer, readlen) != SPI_FLASH_RESULT_OK) {
+			return false;
+		}
+		*crc = crc32_update(*crc, (uint8_t*)buffer, readlen);
+		addr += readlen;
+		len -= readlen;
+	}
+	*crc ^= 0xffffffff;
+	return true;
+}
+
+// check one sector of a rom against its manifest entry
+static bool ICACHE_FLASH_ATTR check_sector(rboot_scrub_status *status, uint16_t sector, bool *good) {
+	uint32_t offset = sector * SECTOR_SIZE;
+	uint32_t len = status->length - offset;
+	uint32_t expected;
+	uint32_t crc;
+
+	if (len > SECTOR_SIZE) len = SECTOR_SIZE;
+	if (spi_flash_read(status->manifest + sizeof(rboot_manifest) + (sector * 4), &expected, 4) != SPI_FLASH_RESULT_OK ||
+		!crc_flash(status->start_addr + offset, len, &crc)) {
+		return false;
+	}
+	*good = (crc == expected);
+	return true;
+}
+
+// find and check the manifest of a rom
+bool ICACHE_FLASH_ATTR rboot_scrub_init(rboot_scrub_status *status, uint8_t rom) {
+	rboot_config conf;
+	rboot_manifest manifest;
+	uint32_t pos;
+	uint32_t crc;
+
+	memset(status, 0, sizeof(rboot_scrub_status));
+	conf = rboot_get_config();
+	if (rom >= conf.count) return false;
+	status->start_addr = conf.roms[rom];
+	pos = rboot_get_rom_length(status->start_addr);
+	if (pos == 0) return false;
+
+	// manifest follows the checksum, or the signature block if there is one
+	if (spi_flash_read(status->start_addr + pos, (uint32_t*)((void*)&manifest), sizeof(rboot_manifest)) != SPI_FLASH_RESULT_OK) {
+		return false;
+	}
+	if (manifest.magic == RBOOT_SIG_MAGIC) {
+		pos += sizeof(uint32_t) + RBOOT_SIG_LEN;
+		if (spi_flash_read(status->start_addr + pos, (uint32_t*)((void*)&manifest), sizeof(rboot_manifest)) != SPI_FLASH_RESULT_OK) {
+			return false;
+		}
+	}
+	if (manifest.magic != RBOOT_MANIFEST_MAGIC || manifest.length != pos ||
+		manifest.count != (pos + SECTOR_SIZE - 1) / SECTOR_SIZE || manifest.count > RBOOT_SCRUB_MAX_SECTORS) {
+		return false;
+	}
+
+	// check the manifest itself is intact
+	status->manifest = status->start_addr + pos;
+	if (!crc_flash(status->manifest + sizeof(rboot_manifest), manifest.count * 4, &crc) || crc != manifest.crc) {
+		return false;
+	}
+	status->length = manifest.length;
+	status->count = manifest.count;
+	return true;
+}
+
+// check the next few sectors
+bool ICACHE_FLASH_ATTR rboot_scrub_step(rboot_scrub_status *status, uint16_t sectors) {
+	bool good;
+
+	while (sectors-- > 0 && status->next < status->count) {
+		if (!check_sector(status, status->next, &good)) {
+			return false;
+		}
+		if (!good && !(status->bad_map[status->next / 32] & (1u << (status->next % 32)))) {
+			status->bad_map[status->next / 32] |= 1u << (status->next % 32);
+			status->bad++;
+		}
+		status->next++;
+	}
+	return true;
+}
+
+// rewrite each bad sector found so far, fetching its contents from the caller
+bool ICACHE_FLASH_ATTR rboot_scrub_repair(rboot_scrub_status *status, rboot_fetch_func fetch, void *arg) {
+	uint32_t buffer[RBOOT_COPY_CHUNK / 4];
+	uint32_t total;
+	uint32_t offset;
+	uint32_t end;
+	uint32_t readlen;
+	uint16_t sector;
+	bool good;
+
+	// the whole file, so a sector shared with the manifest is restored complete
+	total = status->length + sizeof(rboot_manifest) + (status->count * 4);
+
+	for (sector = 0; sector < status->count && status->bad > 0; sector++) {
+		if (!(status->bad_map[sector / 32] & (1u << (sector % 32)))) {
+			continue;
+		}
+		offset = sector * SECTOR_SIZE;
+		end = (total - offset < SECTOR_SIZE) ? total : offset + SECTOR_SIZE;
+#ifdef BOOT_READ_CACHE
+		rboot_cache_invalidate(status->start_addr + offset, SECTOR_SIZE);
+#endif
+		if (spi_flash_erase_sector((status->start_addr + offset) / SECTOR_SIZE) != SPI_FLASH_RESULT_OK) {
+			return false;
+		}
+		while (offset < end) {
+			readlen = (end - offset < sizeof(buffer)) ? end - offset : sizeof(buffer);
+			if (!fetch(offset, (uint8_t*)buffer, readlen, arg) ||
+				spi_flash_write(status->start_addr + offset, buffer, readlen) != SPI_FLASH_RESULT_OK) {
+				return false;
+			}
+			offset += readlen;
+		}
+		if (!check_sector(status, sector, &good) || !good) {
+			return false;
+		}
+		status->bad_map[sector / 32] &= ~(1u << (sector % 32));
+		status->bad--;
+	}
+	return (status->bad == 0);
+}
+#endif
+
+#ifdef BOOT_INSTALLER
+// ask rBoot to install a staged update on the next boot
+bool ICACHE_FLASH_ATTR rboot_set_install(uint32_t addr, uint32_t len, uint8_t rom) {
+	rboot_config conf;
+	conf = rboot_get_config();
+	if (rom >= conf.count) return false;
+#if defined(BOOT_SIGNATURE) || defined(BOOT_ROM_DIGEST)
+	invalidate_rom(conf.roms[rom]);
+	conf = rboot_get_config();
+#endif
+	conf.install.addr = addr;
+	conf.install.len = len;
+	conf.install.rom = rom;
+	conf.install.pending = RBOOT_INSTALL_PENDING;
+	// boot the new rom once installed
+	conf.current_rom = rom;
+	return rboot_set_config(&conf);
+}
+#endif
+
+#ifdef BOOT_BUNDLE
+// start writing the next part of a bundle
+static void ICACHE_FLASH_ATTR bundle_next(rboot_bundle_status *status) {
+	rboot_bundle_part *part = &status->header.parts[status->part];
+	write_setup(&status->write, part->addr);
+	status->done = 0;
+}
+
+// table of contents received, check it and get ready for the data
+static bool ICACHE_FLASH_ATTR bundle_start(rboot_bundle_status *status) {
+	rboot_config conf;
+	rboot_bundle_part *part;
+	uint32_t flash;
+	uint32_t run_start;
+	uint32_t run_end;
+	uint8_t loop;
+	uint8_t other;
+
+	conf = rboot_get_config();
+	if (status->header.boot != RBOOT_BUNDLE_NO_ROM && status->header.boot >= conf.count) {
+		return false;
+	}
+	flash = flash_size();
+	if (flash == 0 || conf.current_rom >= conf.count) {
+		return false;
+	}
+	run_start = conf.roms[conf.current_rom];
+	run_end = slot_end(&conf, conf.current_rom);
+	for (loop = 0; loop < status->header.count; loop++) {
+		part = &status->header.parts[loop];
+		// rom parts go to the address of that rom slot
+		if (part->rom != RBOOT_BUNDLE_NO_ROM) {
+			if (part->rom >= conf.count || part->rom == conf.current_rom) {
+				return false;
+			}
+			part->addr = conf.roms[part->rom];
+		}
+		if (part->length == 0 || (part->addr % SECTOR_SIZE) != 0) {
+			return false;
+		}
+		// every part must be on the flash, clear of rBoot and its config
+		// and of the running rom (checked this way round so can't wrap)
+		if (part->addr < SECTOR_SIZE * (BOOT_CONFIG_SECTOR + 1) || part->addr >= flash ||
+			part->length > flash - part->addr ||
+			(part->addr < run_end && run_start < part->addr + part->length)) {
+			return false;
+		}
+		// parts must not overlap each other
+		for (other = 0; other < loop; other++) {
+			if (part->addr < status->header.parts[other].addr + status->header.parts[other].length &&
+				status->header.parts[other].addr < part->addr + part->length) {
+				return false;
+			}
+		}
+	}
+
+#if defined(BOOT_SIGNATURE) || defined(BOOT_ROM_DIGEST)
+	// invalidate all the roms about to be written, in one config write
+	other = 0;
+	for (loop = 0; loop < status->header.count; loop++) {
+		if (invalidate_config(&conf, status->header.parts[loop].addr)) other = 1;
+	}
+	if (other && !rboot_set_config(&conf)) {
+		return false;
+	}
+#endif
+
+	status->part = 0;
+	bundle_next(status);
+	return true;
+}
+
+// a part has been received, check it was written correctly
+static bool ICACHE_FLASH_ATTR bundle_part_end(rboot_bundle_status *status) {
+	rboot_bundle_part *part = &status->header.parts[status->part];
+	uint8_t digest[SHA256_DIGEST_LEN];
+
+	if (!write_flush(&status->write) || !hash_flash(part->addr, part->length, digest) ||
+		memcmp(digest, part->digest, SHA256_DIGEST_LEN) != 0) {
+		return false;
+	}
+	status->part++;
+	if (status->part < status->header.count) {
+		bundle_next(status);
+	}
+	return true;
+}
+
+void ICACHE_FLASH_ATTR rboot_bundle_init(rboot_bundle_status *status) {
+	memset(status, 0, sizeof(rboot_bundle_status));
+	status->state = RBOOT_BUNDLE_HEADER;
+}
+
+// route the next block of the bundle stream to the right place
+bool ICACHE_FLASH_ATTR rboot_bundle_write(rboot_bundle_status *status, uint8_t *data, uint16_t len) {
+	uint8_t *header = (uint8_t*)&status->header;
+	uint32_t need;
+	uint32_t take;
+
+	while (len > 0 && status->state != RBOOT_BUNDLE_ERROR) {
+		if (status->state == RBOOT_BUNDLE_HEADER || status->state == RBOOT_BUNDLE_TOC) {
+			// collect the header, then the table of contents
+			need = RBOOT_BUNDLE_HEADER_LEN;
+			if (status->state == RBOOT_BUNDLE_TOC) {
+				need += status->header.count * sizeof(rboot_bundle_part);
+			}
+			take = need - status->done;
+			if (take > len) take = len;
+			memcpy(header + status->done, data, take);
+			status->done += take;
+			data += take;
+			len -= take;
+			if (status->done < need) {
+				break;
+			}
+			if (status->state == RBOOT_BUNDLE_HEADER) {
+				if (status->header.magic != RBOOT_BUNDLE_MAGIC || status->header.count == 0 ||
+					status->header.count > RBOOT_BUNDLE_MAX_PARTS) {
+					status->state = RBOOT_BUNDLE_ERROR;
+				} else {
+					status->state = RBOOT_BUNDLE_TOC;
+				}
+			} else {
+				status->state = bundle_start(status) ? RBOOT_BUNDLE_DATA : RBOOT_BUNDLE_ERROR;
+			}
+		} else if (status->state == RBOOT_BUNDLE_DATA) {
+			take = status->header.parts[status->part].length - status->done;
+			if (take > len) take = len;
+			if (!rboot_write_flash(&status->write, data, take)) {
+				status->state = RBOOT_BUNDLE_ERROR;
+				break;
+			}
+			status->done += take;
+			data += take;
+			len -= take;
+			if (status->done == status->header.parts[status->part].length) {
+				if (!bundle_part_end(status)) {
+					status->state = RBOOT_BUNDLE_ERROR;
+				} else if (status->part == status->header.count) {
+					status->state = RBOOT_BUNDLE_COMPLETE;
+				}
+			}
+		} else {
+			// more data than the bundle said there would be
+			status->state = RBOOT_BUNDLE_ERROR;
+		}
+	}
+	return (status->state != RBOOT_BUNDLE_ERROR);
+}
+
+// all parts received and checked, update the config in one go
+bool ICACHE_FLASH_ATTR rboot_bundle_end(rboot_bundle_status *status) {
+	rboot_config conf;
+#ifdef BOOT_ROM_DIGEST
+	rboot_bundle_part *part;
+	uint8_t loop;
+#endif
+
+	if (status->state != RBOOT_BUNDLE_COMPLETE) {
+		return false;
+	}
+	conf = rboot_get_config();
+#ifdef BOOT_ROM_DIGEST
+	for (loop = 0; loop < status->header.count; loop++) {
+		part = &status->header.parts[loop];
+		if (part->rom != RBOOT_BUNDLE_NO_ROM) {
+			memcpy(conf.digest[part->rom], part->digest, RBOOT_DIGEST_LEN);
+		}
+	}
+#endif
+	if (status->header.boot != RBOOT_BUNDLE_NO_ROM) {
+		conf.current_rom = status->header.boot;
+	}
+	status->state = RBOOT_BUNDLE_DONE;
+	return rboot_set_config(&conf);
+}
+#endif
+
+#ifdef BOOT_HIBERNATE
+// find the normal (0xe9) header of a rom, skipping the extra
+// header and irom section of a new type rom
+static uint32_t ICACHE_FLASH_ATTR hibernate_rom_header(uint32_t addr, uint32_t *header) {
+	uint8_t *magic = (uint8_t*)header;
+	if (spi_flash_read(addr, header, 8) != SPI_FLASH_RESULT_OK) {
+		return 0;
+	}
+	if (magic[0] == ROM_MAGIC_NEW1 && magic[1] == ROM_MAGIC_NEW2) {
+		if (spi_flash_read(addr + 8, header, 8) != SPI_FLASH_RESULT_OK) {
+			return 0;
+		}
+		addr += 16 + header[1];
+		if (spi_flash_read(addr, header, 8) != SPI_FLASH_RESULT_OK) {
+			return 0;
+		}
+	}
+	return (magic[0] == ROM_MAGIC) ? addr : 0;
+}
+
+// save a snapshot of the running rom and the specified dram regions, as
+// a rom image rBoot can load on the next deep sleep wake, with resume as
+// the entry point
+bool ICACHE_FLASH_ATTR rboot_hibernate_save(uint32_t addr, const rboot_hibernate_region *regions,
+	uint8_t count, void (*resume)(void)) {
+
+	uint32_t buffer[RBOOT_COPY_CHUNK / 4];
+	uint32_t header[2];
+	uint8_t *magic = (uint8_t*)header;
+	rboot_hibernate_data hib;
+	rboot_config conf;
+	uint32_t romaddr;
+	uint32_t readpos;
+	uint32_t writepos;
+	uint32_t remaining;
+	uint32_t len;
+	uint32_t loop;
+	uint8_t romcount;
+	uint8_t rom;
+	uint8_t current;
+	uint8_t chksum = CHKSUM_INIT;
+
+	// regions must be whole words of dram, and not include the stack
+	for (current = 0; current < count; current++) {
+		if ((regions[current].addr & 3) || (regions[current].len & 3) ||
+			regions[current].addr < RBOOT_HIBERNATE_DRAM_START ||
+			regions[current].addr >= RBOOT_HIBERNATE_DRAM_END ||
+			regions[current].len > RBOOT_HIBERNATE_DRAM_END - regions[current].addr) {
+			return false;
+		}
+	}
+
+	// find the running rom, the snapshot includes its sections
+	conf = rboot_get_config();
+	if (!rboot_get_last_boot_rom(&rom) || rom >= conf.count ||
+		(romaddr = hibernate_rom_header(conf.roms[rom], header)) == 0 ||
+		magic[1] + count > 0xff) {
+		return false;
+	}
+	romcount = magic[1];
+
+	// work out the snapshot length
+	readpos = romaddr + sizeof(header);
+	for (current = 0; current < romcount; current++) {
+		if (spi_flash_read(readpos, header, sizeof(header)) != SPI_FLASH_RESULT_OK ||
+			(header[1] & 3) || header[1] > 0x100000) {
+			return false;
+		}
+		readpos += sizeof(header) + header[1];
+	}
+	len = sizeof(header) + (readpos - (romaddr + sizeof(header)));
+	for (current = 0; current < count; current++) {
+		len += sizeof(header) + regions[current].len;
+	}
+	len = (len | 0x0f) + 1;
+
+	// make sure a part written snapshot can't be resumed (the erase
+	// also drops the area from the read cache, if enabled)
+	rboot_hibernate_clear();
+	if (!rboot_erase_flash(addr, len)) {
+		return false;
+	}
+
+	// header, copying the flash mode and size from the rom
+	if (spi_flash_read(romaddr, header, sizeof(header)) != SPI_FLASH_RESULT_OK) {
+		return false;
+	}
+	magic[1] = romcount + count;
+	header[1] = (uint32_t)resume;
+	if (spi_flash_write(addr, header, sizeof(header)) != SPI_FLASH_RESULT_OK) {
+		return false;
+	}
+	writepos = addr + sizeof(header);
+	readpos = romaddr + sizeof(header);
+
+	// copy the rom's sections
+	for (current = 0; current < romcount; current++) {
+		if (spi_flash_read(readpos, header, sizeof(header)) != SPI_FLASH_RESULT_OK ||
+			spi_flash_write(writepos, header, sizeof(header)) != SPI_FLASH_RESULT_OK) {
+			return false;
+		}
+		readpos += sizeof(header);
+		writepos += sizeof(header);
+		for (remaining = header[1]; remaining > 0; remaining -= len) {
+			len = (remaining < sizeof(buffer)) ? remaining : sizeof(buffer);
+			if (spi_flash_read(readpos, buffer, len) != SPI_FLASH_RESULT_OK ||
+				spi_flash_write(writepos, buffer, len) != SPI_FLASH_RESULT_OK) {
+				return false;
+			}
+			for (loop = 0; loop < len; loop++) {
+				chksum ^= ((uint8_t*)buffer)[loop];
+			}
+			readpos += len;
+			writepos += len;
+		}
+	}
+
+	// then the dram regions, written straight from ram, loaded after
+	// the rom's sections so they replace its initial data
+	for (current = 0; current < count; current++) {
+		header[0] = regions[current].addr;
+		header[1] = regions[current].len;
+		if (spi_flash_write(writepos, header, sizeof(header)) != SPI_FLASH_RESULT_OK ||
+			spi_flash_write(writepos + sizeof(header), (uint32_t*)regions[current].addr,
+				regions[current].len) != SPI_FLASH_RESULT_OK) {
+			return false;
+		}
+		writepos += sizeof(header) + regions[current].len;
+		for (loop = 0; loop < regions[current].len; loop++) {
+			chksum ^= ((uint8_t*)regions[current].addr)[loop];
+		}
+	}
+
+	// checksum is the last byte of the 16 byte block
+	len = 16 - (writepos & 0x0f);
+	memset(buffer, 0, len);
+	((uint8_t*)buffer)[len - 1] = chksum;
+	if (spi_flash_write(writepos, buffer, len) != SPI_FLASH_RESULT_OK) {
+		return false;
+	}
+
+	// stamp it for rBoot, only valid for a wake in place of this rom
+	hib.magic = RBOOT_HIBERNATE_MAGIC;
+	hib.addr = addr;
+	hib.rom = rom;
+	hib.unused[0] = hib.unused[1] = 0;
+	hib.chksum = calc_chksum((uint8_t*)&hib, (uint8_t*)&hib.chksum);
+	return system_rtc_mem_write(RBOOT_HIBERNATE_RTC_ADDR, &hib, sizeof(rboot_hibernate_data));
+}
+
+// discard any saved snapshot, so the next wake is a normal boot
+bool ICACHE_FLASH_ATTR rboot_hibernate_clear(void) {
+	rboot_hibernate_data hib;
+	memset(&hib, 0, sizeof(rboot_hibernate_data));
+	return system_rtc_mem_write(RBOOT_HIBERNATE_RTC_ADDR, &hib, sizeof(rboot_hibernate_data));
+}
+#endif
+
+#ifdef BOOT_RESET_ROUTING
+// choose the rom rBoot boots after a particular type of reset
+bool ICACHE_FLASH_ATTR rboot_set_reason_rom(uint8_t reason, uint8_t rom) {
+	rboot_config conf;
+	conf = rboot_get_config();
+	if (reason >= RBOOT_REASON_COUNT || (rom >= conf.count && rom != RBOOT_NO_ROUTE)) {
+		return false;
+	}
+	if (!(conf.mode & MODE_REASON_ROM)) {
+		// first use, route nothing else
+		memset(conf.reason_rom, RBOOT_NO_ROUTE, RBOOT_REASON_COUNT);
+		conf.mode |= MODE_REASON_ROM;
+	}
+	conf.reason_rom[reason] = rom;
+	return rboot_set_config(&conf);
+}
+#endif
+
+#ifdef BOOT_SIGNATURE
+// check the signature on a rom, using the supplied verify function, and
+// record an attestation in the config so rBoot will allow it to boot
+bool ICACHE_FLASH_ATTR rboot_verify_rom(uint8_t rom, rboot_verify_func verify, void *arg) {
+	rboot_config conf;
+	rboot_signature sig;
+	uint8_t digest[SHA256_DIGEST_LEN];
+	uint32_t addr;
+	uint32_t len;
+
+	conf = rboot_get_config();
+	if (rom >= conf.count || verify == NULL) return false;
+	addr = conf.roms[rom];
+	len = rboot_get_rom_length(addr);
+	if (len == 0) return false;
+
+	// digest covers the whole image, including the checksum
+	if (!hash_flash(addr, len, digest)) {
+		return false;
+	}
+
+	// signature block immediately follows the checksum
+	if (spi_flash_read(addr + len, (uint32_t*)((void*)&sig), sizeof(rboot_signature)) != SPI_FLASH_RESULT_OK ||
+		sig.magic != RBOOT_SIG_MAGIC || !verify(digest, sig.signature, arg)) {
+		return false;
+	}
+
+	conf.attest[rom].rom = rom;
+	conf.attest[rom].generation = conf.generation[rom];
+	memcpy(conf.attest[rom].digest, digest, sizeof(conf.attest[rom].digest));
+	return rboot_set_config(&conf);
+}
+#endif
+
+#ifdef BOOT_RTC_ENABLED
+bool ICACHE_FLASH_ATTR rboot_get_rtc_data(rboot_rtc_data *rtc) {
+	if (system_rtc_mem_read(RBOOT_RTC_ADDR, rtc, sizeof(rboot_rtc_data))) {
+		return (rtc->chksum == calc_chksum((uint8_t*)rtc, (uint8_t*)&rtc->chksum));
+	}
+	return false;
+}
+
+bool ICACHE_FLASH_ATTR rboot_set_rtc_data(rboot_rtc_data *rtc) {
+	// calculate checksum
+	rtc->chksum = calc_chksum((uint8_t*)rtc, (uint8_t*)&rtc->chksum);
+	return system_rtc_mem_write(RBOOT_RTC_ADDR, rtc, sizeof(rboot_rtc_data));
+}
+
+bool ICACHE_FLASH_ATTR rboot_set_temp_rom(uint8_t rom) {
+	rboot_rtc_data rtc;
+	// invalid data in rtc?
+	if (!rboot_get_rtc_data(&rtc)) {
+		// set basics
+		rtc.magic = RBOOT_RTC_MAGIC;
+		rtc.last_mode = MODE_STANDARD;
+		rtc.last_rom = 0;
+	}
+	// set next boot to temp mode with specified rom
+	rtc.next_mode = MODE_TEMP_ROM;
+	rtc.temp_rom = rom;
+
+	return rboot_set_rtc_data(&rtc);
+}
+
+bool ICACHE_FLASH_ATTR rboot_get_last_boot_rom(uint8_t *rom) {
+	rboot_rtc_data rtc;
+	if (rboot_get_rtc_data(&rtc)) {
+		*rom = rtc.last_rom;
+		return true;
+	}
+	return false;
+}
+
+bool ICACHE_FLASH_ATTR rboot_get_last_boot_mode(uint8_t *mode) {
+	rboot_rtc_data rtc;
+	if (rboot_get_rtc_data(&rtc)) {
+		*mode = rtc.last_mode;
+		return true;
+	}
+	return false;
+}
+
+#ifdef BOOT_RESET_ROUTING
+bool ICACHE_FLASH_ATTR rboot_get_last_boot_reason(uint8_t *reason) {
+	rboot_rtc_data rtc;
+	if (rboot_get_rtc_data(&rtc)) {
+		*reason = rtc.last_reason;
+		return true;
+	}
+	return false;
+}
+#endif
 #endif
 
 #ifdef __cplusplus
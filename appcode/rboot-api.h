@@ -18,6 +18,34 @@
 extern "C" {
 #endif
 
+#ifdef BOOT_OTA_STATS
+// number of buckets in the write call latency histogram, bucket n
+// counts calls taking under 2^n ms (the last counts all the rest)
+#ifndef RBOOT_STATS_BUCKETS
+#define RBOOT_STATS_BUCKETS 8
+#endif
+
+/**	@brief  Statistics for a flash write
+ *  @note   Times are in microseconds, from system_get_time.
+ *	@see    rboot_write_get_stats
+*/
+typedef struct {
+	uint32_t start_time;      ///< Time of rboot_write_init
+	uint32_t elapsed_us;      ///< Time since rboot_write_init (set by rboot_write_get_stats)
+	uint32_t bytes;           ///< Bytes written to flash
+	uint32_t calls;           ///< Calls to rboot_write_flash
+	uint32_t sectors_erased;  ///< Sectors erased, including by rboot_write_erase
+	uint32_t erase_us;        ///< Time spent erasing
+	uint32_t program_us;      ///< Time spent programming
+	uint32_t worst_call_us;   ///< Longest rboot_write_flash call
+	uint32_t heap_peak;       ///< Largest buffer allocated by the writer
+	uint32_t heap_free_min;   ///< Lowest free heap seen during the write
+#if RBOOT_STATS_BUCKETS > 0
+	uint16_t latency[RBOOT_STATS_BUCKETS]; ///< Histogram of rboot_write_flash call times
+#endif
+} rboot_write_stats;
+#endif
+
 /**	@brief  Structure defining flash write status
  *  @note   The user application should not modify the contents of this
  *          structure.
@@ -30,8 +58,283 @@ typedef struct {
 	int32_t last_sector_erased;
 	uint8_t extra_count;
 	uint8_t extra_bytes[4];
+#ifdef BOOT_ROM_DIGEST
+	uint32_t origin;
+	uint32_t length;
+#endif
+#ifdef BOOT_OTA_STATS
+	rboot_write_stats stats;
+#endif
 } rboot_write_status;
 
+#ifdef BOOT_OTA_PIPE
+// the pipeline writer writes whole multiples of this (a flash page)
+#define RBOOT_PIPE_PAGE 256
+
+// rboot_pipe result
+#define RBOOT_PIPE_RUNNING 0
+#define RBOOT_PIPE_DONE    1
+#define RBOOT_PIPE_ERROR   2
+
+/**	@brief  Notification from the ota pipeline
+ *	@param  arg The arg passed to rboot_pipe_init
+ *  @note   Called from the other side's context, so should only wake the
+ *          task (e.g. xTaskNotifyGive or system_os_post), spurious calls
+ *          must be harmless.
+*/
+typedef void (*rboot_pipe_notify)(void *arg);
+
+/**	@brief  Structure defining ota pipeline status
+ *  @note   The user application should not modify the contents of this
+ *          structure. head is only written by the producer and tail only
+ *          by the writer, so neither side needs a lock. The write is
+ *          complete when result is RBOOT_PIPE_DONE.
+ *	@see    rboot_pipe_push
+*/
+typedef struct {
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	volatile uint8_t closed;
+	volatile uint8_t waiting;
+	volatile uint8_t result;
+	uint8_t *buffer;
+	uint32_t size;
+	rboot_pipe_notify writer;
+	rboot_pipe_notify producer;
+	void *arg;
+	rboot_write_status write;
+} rboot_pipe;
+#endif
+
+#ifdef BOOT_MMAP_READ
+/**	@brief  Function run by rboot_mmap_run with a flash segment mapped
+ *	@param  data Mapped address of the flash data asked for
+ *	@param  arg The arg passed to rboot_mmap_run
+*/
+typedef void (*rboot_mmap_func)(const void *data, void *arg);
+#endif
+
+#ifdef BOOT_READ_CACHE
+// bytes per read cache line, a power of 2 (a flash page by default)
+#ifndef RBOOT_CACHE_LINE
+#define RBOOT_CACHE_LINE 256
+#endif
+// extra lines fetched with a miss that follows on from the last one
+#ifndef RBOOT_CACHE_AHEAD
+#define RBOOT_CACHE_AHEAD 3
+#endif
+
+/**	@brief  Statistics for the flash read cache, counted in lines
+ *	@see    rboot_cache_get_stats
+*/
+typedef struct {
+	uint32_t hits;         ///< Lines found in the cache
+	uint32_t misses;       ///< Lines read from the flash when needed
+	uint32_t ahead;        ///< Lines read ahead of a sequential miss
+	uint32_t flash_reads;  ///< spi_flash_read calls made by the cache
+	uint32_t invalidated;  ///< Lines dropped because the flash under them was written
+} rboot_cache_stats;
+#endif
+
+// page size tracked by the out of order writer, must divide SECTOR_SIZE
+#ifndef RBOOT_CHUNK_PAGE
+#define RBOOT_CHUNK_PAGE 256
+#endif
+// pages received between saves of the out of order writer state
+#ifndef RBOOT_CHUNK_SAVE_PAGES
+#define RBOOT_CHUNK_SAVE_PAGES 16
+#endif
+#define RBOOT_CHUNK_MAGIC 0x4b4e4843
+
+/**	@brief  Structure defining out of order flash write status
+ *  @note   The user application should not modify the contents of this
+ *          structure.
+ *	@see    rboot_chunk_write
+*/
+typedef struct {
+	uint32_t start_addr;
+	uint32_t length;
+	uint32_t state_sector;
+	uint32_t pages;
+	uint32_t received;
+	uint16_t unsaved;
+	uint16_t dirty_lo;
+	uint16_t dirty_hi;
+	uint32_t *bitmap;
+} rboot_chunk_status;
+
+// chunk size used by rom copy (stack use is twice this)
+#ifndef RBOOT_COPY_CHUNK
+#define RBOOT_COPY_CHUNK 256
+#endif
+
+/**	@brief  Structure defining rom copy status
+ *  @note   The user application should not modify the contents of this
+ *          structure. The copy is complete when done equals length.
+ *	@see    rboot_copy_step
+*/
+typedef struct {
+	uint32_t src_addr;
+	uint32_t dst_addr;
+	uint32_t length;
+	uint32_t done;
+	uint16_t copied;
+	uint16_t skipped;
+	uint8_t src_rom;
+	uint8_t dst_rom;
+} rboot_copy_status;
+
+#ifdef BOOT_OVERLAY
+// iram window overlays are loaded into, default is the top 4KB of
+// iram, which must be removed from iram1_0_seg in the app's linker script
+#ifndef RBOOT_OVERLAY_ADDR
+#define RBOOT_OVERLAY_ADDR 0x40107000
+#endif
+#ifndef RBOOT_OVERLAY_LEN
+#define RBOOT_OVERLAY_LEN 0x1000
+#endif
+#endif
+
+#ifdef BOOT_BUNDLE
+#define RBOOT_BUNDLE_MAGIC 0x444e4252
+#define RBOOT_BUNDLE_NO_ROM 0xff
+#define RBOOT_BUNDLE_HEADER_LEN 8
+// most parts a bundle can have
+#ifndef RBOOT_BUNDLE_MAX_PARTS
+#define RBOOT_BUNDLE_MAX_PARTS 4
+#endif
+
+// bundle parser states
+#define RBOOT_BUNDLE_HEADER   0
+#define RBOOT_BUNDLE_TOC      1
+#define RBOOT_BUNDLE_DATA     2
+#define RBOOT_BUNDLE_COMPLETE 3
+#define RBOOT_BUNDLE_DONE     4
+#define RBOOT_BUNDLE_ERROR    5
+
+/**	@brief  Bundle table of contents entry, one for each part of the bundle
+ *  @note   Part data follows the table of contents, in the same order.
+*/
+typedef struct {
+	uint8_t rom;        ///< ROM slot to write to, or RBOOT_BUNDLE_NO_ROM to use addr
+	uint8_t unused[3];  ///< Padding (not used)
+	uint32_t addr;      ///< Flash address to write to (sector aligned), if not a ROM
+	uint32_t length;    ///< Length of the part
+	uint8_t digest[32]; ///< SHA-256 of the part
+} rboot_bundle_part;
+
+/**	@brief  Bundle header, as made by the rboot-bundle tool
+*/
+typedef struct {
+	uint32_t magic;     ///< Should be RBOOT_BUNDLE_MAGIC
+	uint8_t count;      ///< Number of parts
+	uint8_t boot;       ///< ROM to boot once installed, or RBOOT_BUNDLE_NO_ROM
+	uint8_t unused[2];  ///< Padding (not used)
+	rboot_bundle_part parts[RBOOT_BUNDLE_MAX_PARTS];
+} rboot_bundle_header;
+
+/**	@brief  Structure defining bundle write status
+ *  @note   The user application should not modify the contents of this
+ *          structure.
+ *	@see    rboot_bundle_write
+*/
+typedef struct {
+	uint8_t state;
+	uint8_t part;
+	uint32_t done;
+	rboot_bundle_header header;
+	rboot_write_status write;
+} rboot_bundle_status;
+#endif
+
+#ifdef BOOT_HIBERNATE
+// dram a snapshot can restore, the default end leaves out the top
+// 16KB, which holds the stack (including rBoot's while it resumes)
+#ifndef RBOOT_HIBERNATE_DRAM_START
+#define RBOOT_HIBERNATE_DRAM_START 0x3ffe8000
+#endif
+#ifndef RBOOT_HIBERNATE_DRAM_END
+#define RBOOT_HIBERNATE_DRAM_END 0x3fffc000
+#endif
+
+/**	@brief  A region of dram to save in a hibernate snapshot
+ *	@see    rboot_hibernate_save
+*/
+typedef struct {
+	uint32_t addr;  ///< Start of the region, word aligned
+	uint32_t len;   ///< Length of the region, a multiple of 4
+} rboot_hibernate_region;
+#endif
+
+#define RBOOT_SIG_MAGIC 0x47495352
+#define RBOOT_SIG_LEN   64
+
+#ifdef BOOT_MANIFEST
+#define RBOOT_MANIFEST_MAGIC 0x4e414d52
+// largest rom the scrubber can track, in sectors
+#ifndef RBOOT_SCRUB_MAX_SECTORS
+#define RBOOT_SCRUB_MAX_SECTORS 256
+#endif
+
+/**	@brief  Sector crc manifest header, placed after the rom checksum (and
+ *          signature block, if there is one) and followed by count crc32s
+ *  @note   Each crc32 covers one sector of the image, the last one only up to
+ *          length. Added to an image with rboot-pack -manifest.
+ *	@see    rboot_scrub_init
+*/
+typedef struct {
+	uint32_t magic;   ///< Should be RBOOT_MANIFEST_MAGIC
+	uint32_t length;  ///< Length of the image before the manifest
+	uint32_t count;   ///< Number of sector crcs that follow
+	uint32_t crc;     ///< crc32 of the sector crcs
+} rboot_manifest;
+
+/**	@brief  Structure defining rom scrub status
+ *  @note   The user application should not modify the contents of this
+ *          structure. All sectors have been checked when next equals count,
+ *          bad is the number of sectors found not to match the manifest.
+ *	@see    rboot_scrub_step
+*/
+typedef struct {
+	uint32_t start_addr;
+	uint32_t length;
+	uint32_t manifest;
+	uint16_t count;
+	uint16_t next;
+	uint16_t bad;
+	uint32_t bad_map[RBOOT_SCRUB_MAX_SECTORS / 32];
+} rboot_scrub_status;
+
+/**	@brief  Fetch function used to repair a rom, supplied by the user app
+ *  @param  offset Offset of the data required, from the start of the image file
+ *  @param  buffer Buffer to fill
+ *  @param  len Number of bytes required (at most RBOOT_COPY_CHUNK)
+ *  @param  arg User argument passed to rboot_scrub_repair
+ *  @retval bool True if the buffer was filled
+*/
+typedef bool (*rboot_fetch_func)(uint32_t offset, uint8_t *buffer, uint32_t len, void *arg);
+#endif
+
+#ifdef BOOT_SIGNATURE
+/**	@brief  Signature block, placed immediately after the rom checksum
+ *  @note   The signature is over the SHA-256 digest of the rom image, from
+ *          the start of the header up to and including the checksum byte.
+ *	@see    rboot_verify_rom
+*/
+typedef struct {
+	uint32_t magic;                    ///< Should be RBOOT_SIG_MAGIC
+	uint8_t signature[RBOOT_SIG_LEN];  ///< Signature data, e.g. Ed25519
+} rboot_signature;
+
+/**	@brief  Signature check function, supplied by the user app
+ *  @param  digest SHA-256 digest of the rom image (32 bytes)
+ *  @param  signature Signature from the rom's signature block (RBOOT_SIG_LEN bytes)
+ *  @param  arg User argument passed to rboot_verify_rom
+ *  @retval bool True if the signature is valid for the digest
+*/
+typedef bool (*rboot_verify_func)(const uint8_t *digest, const uint8_t *signature, void *arg);
+#endif
+
 /**	@brief	Read rBoot configuration from flash
  *	@retval rboot_config Copy of the rBoot configuration
  *  @note   Returns rboot_config (defined in rboot.h) allowing you to modify any values
@@ -65,6 +368,22 @@ uint8_t ICACHE_FLASH_ATTR rboot_get_current_rom(void);
 */
 bool ICACHE_FLASH_ATTR rboot_set_current_rom(uint8_t rom);
 
+/**	@brief  Get the length of a rom image on the flash
+ *	@param  addr Flash address of the start of the rom
+ *	@retval uint32_t Length of the image, including the checksum, or 0 if not a valid rom
+ *  @note   Walks the rom and section headers, the checksum itself is not checked.
+*/
+uint32_t ICACHE_FLASH_ATTR rboot_get_rom_length(uint32_t addr);
+
+/**	@brief  Erase an area of the flash
+ *	@param  addr Flash address of the start of the area
+ *	@param  len Length of the area
+ *	@retval bool True on success
+ *  @note   Erases every sector that overlaps the area. With BOOT_BLOCK_ERASE
+ *          enabled, aligned 64KB runs are erased with a single block erase.
+*/
+bool ICACHE_FLASH_ATTR rboot_erase_flash(uint32_t addr, uint32_t len);
+
 /**	@brief  Initialise flash write process
  *	@param  start_addr Address on the SPI flash to begin write to
  *  @note   Call once before starting to pass data to write to flash memory with rboot_write_flash function.
@@ -74,6 +393,16 @@ bool ICACHE_FLASH_ATTR rboot_set_current_rom(uint8_t rom);
 */
 rboot_write_status ICACHE_FLASH_ATTR rboot_write_init(uint32_t start_addr);
 
+/** @brief  Erase the whole area to be written in advance
+ *  @param  status Pointer to rboot_write_status structure defining the write status
+ *  @param  len Total length of the data that will be written
+ *  @retval bool True on success
+ *  @note   Optional, call after rboot_write_init when the size of the image is
+ *          known. Erases the area with rboot_erase_flash (so block erases can
+ *          be used) instead of a sector at a time during rboot_write_flash.
+*/
+bool ICACHE_FLASH_ATTR rboot_write_erase(rboot_write_status *status, uint32_t len);
+
 /** @brief  Complete flash write process
  *  @param  status Pointer to rboot_write_status structure defining the write status
  *  @note   Call at the completion of flash writing. This ensures any
@@ -95,6 +424,382 @@ bool ICACHE_FLASH_ATTR rboot_write_end(rboot_write_status *status);
 */
 bool ICACHE_FLASH_ATTR rboot_write_flash(rboot_write_status *status, uint8_t *data, uint16_t len);
 
+#ifdef BOOT_OTA_STATS
+/**	@brief  Get the statistics for a flash write
+ *	@param  status Pointer to rboot_write_status structure defining the write status
+ *	@param  stats Pointer to rboot_write_stats structure to populate
+ *  @note   Can be called at any time during or after the write. Time not
+ *          spent erasing or programming (elapsed_us - erase_us - program_us)
+ *          is mostly time waiting for data to arrive.
+*/
+void ICACHE_FLASH_ATTR rboot_write_get_stats(rboot_write_status *status, rboot_write_stats *stats);
+#endif
+
+/**	@brief  Initialise out of order flash write process
+ *	@param  status Pointer to rboot_chunk_status structure to initialise
+ *	@param  start_addr Address on the SPI flash of the start of the image (sector aligned)
+ *	@param  len Total length of the image
+ *	@param  image_id Identifies the image being sent, e.g. part of its digest,
+ *          its version or a hash of its ETag
+ *	@param  state_sector Flash sector used to save progress, outside the image
+ *	@retval bool True on success
+ *  @note   If the state sector holds the progress of an earlier, interrupted,
+ *          write of an image with the same id and length to the same address
+ *          that write is resumed, otherwise a new one is started. Use
+ *          rboot_chunk_missing to find out which parts still need to be sent.
+*/
+bool ICACHE_FLASH_ATTR rboot_chunk_init(rboot_chunk_status *status, uint32_t start_addr, uint32_t len, uint32_t image_id, uint32_t state_sector);
+
+/**	@brief  Write a chunk of data at any offset in the image
+ *	@param  status Pointer to rboot_chunk_status structure defining the write status
+ *	@param  offset Offset of the chunk in the image, a multiple of RBOOT_CHUNK_PAGE
+ *	@param  data Pointer to the chunk data
+ *	@param  len Length of the chunk, a multiple of RBOOT_CHUNK_PAGE unless the
+ *          chunk ends the image
+ *	@retval bool True on success
+ *  @note   Chunks can arrive in any order (e.g. from parallel range requests)
+ *          and may be repeated. Each sector is erased when the first page in
+ *          it is received. Progress is saved every RBOOT_CHUNK_SAVE_PAGES pages.
+*/
+bool ICACHE_FLASH_ATTR rboot_chunk_write(rboot_chunk_status *status, uint32_t offset, uint8_t *data, uint32_t len);
+
+/**	@brief  Save out of order write progress to the state sector
+ *	@param  status Pointer to rboot_chunk_status structure defining the write status
+ *	@retval bool True on success
+*/
+bool ICACHE_FLASH_ATTR rboot_chunk_save(rboot_chunk_status *status);
+
+/**	@brief  Find the next part of the image still to be received
+ *	@param  status Pointer to rboot_chunk_status structure defining the write status
+ *	@param  offset Offset in the image to start looking from
+ *	@retval uint32_t Offset of the first missing page at or after offset,
+ *          or the image length if there are none
+*/
+uint32_t ICACHE_FLASH_ATTR rboot_chunk_missing(rboot_chunk_status *status, uint32_t offset);
+
+/**	@brief  Complete (or suspend) an out of order write
+ *	@param  status Pointer to rboot_chunk_status structure defining the write status
+ *	@retval bool True if the whole image has been received
+ *  @note   If the image is complete the state sector is erased, otherwise
+ *          progress is saved so the write can be resumed later.
+*/
+bool ICACHE_FLASH_ATTR rboot_chunk_end(rboot_chunk_status *status);
+
+/**	@brief  Initialise a copy of one rom slot to another
+ *	@param  status Pointer to rboot_copy_status structure to initialise
+ *	@param  src_rom Index of the rom to copy from
+ *	@param  dst_rom Index of the rom to copy to
+ *	@param  len Length to copy, or 0 for the length of the rom image in src_rom
+ *	@retval bool True on success
+ *  @note   Whole sectors are copied, so data appended to the image in its last
+ *          sector (e.g. a signature block) is copied too. Remember that a rom
+ *          is linked for a particular position in the mapped flash, so only
+ *          copy between slots the image can run from. Fails if the copy
+ *          would run past the end of the destination slot (the next slot or
+ *          the end of its 1MB segment) or the flash, or dst_rom is the
+ *          running rom.
+*/
+bool ICACHE_FLASH_ATTR rboot_copy_init(rboot_copy_status *status, uint8_t src_rom, uint8_t dst_rom, uint32_t len);
+
+/**	@brief  Copy the next sector of a rom copy
+ *	@param  status Pointer to rboot_copy_status structure defining the copy status
+ *	@retval bool True on success
+ *  @note   Call repeatedly, e.g. from a timer or task, until status->done equals
+ *          status->length. Each call copies one sector using a small stack
+ *          buffer, no heap is used. Sectors where the destination already
+ *          matches are skipped, otherwise the destination sector is erased
+ *          (unless already blank), written and read back to verify it. When
+ *          the copy completes the destination inherits the source's digest
+ *          and attestation (if enabled).
+*/
+bool ICACHE_FLASH_ATTR rboot_copy_step(rboot_copy_status *status);
+
+#ifdef BOOT_OTA_PIPE
+/**	@brief  Start a pipelined flash write
+ *	@param  pipe Pointer to rboot_pipe structure to initialise
+ *	@param  start_addr Address on the SPI flash to begin writing to
+ *	@param  buffer Ring buffer
+ *	@param  size Size of the ring buffer, a power of 2 and at least RBOOT_PIPE_PAGE
+ *	@param  writer Called (by the producer) when there is data to write
+ *	@param  producer Called (by the writer) when space is freed after a short
+ *          push, and when the write has finished
+ *	@param  arg Passed to the notify functions
+ *	@retval bool False if the buffer is unsuitable
+ *  @note   The producer (e.g. the network task) calls rboot_pipe_push and
+ *          rboot_pipe_close, a separate writer task calls rboot_pipe_service
+ *          each time it is notified. A ring of two sectors lets the network
+ *          fill one while the other is written.
+*/
+bool ICACHE_FLASH_ATTR rboot_pipe_init(rboot_pipe *pipe, uint32_t start_addr, uint8_t *buffer, uint32_t size,
+	rboot_pipe_notify writer, rboot_pipe_notify producer, void *arg);
+
+/**	@brief  Copy data into the pipeline (producer side)
+ *	@param  pipe Pointer to rboot_pipe structure defining the pipeline
+ *	@param  data Data to write
+ *	@param  len Length of the data
+ *	@retval uint32_t Number of bytes taken, less than len if the ring is full
+ *  @note   Never waits for the flash. If not all the data was taken, push the
+ *          rest after the producer notification (stop reading from the
+ *          network in the meantime). Takes nothing once the write has failed.
+*/
+uint32_t ICACHE_FLASH_ATTR rboot_pipe_push(rboot_pipe *pipe, const uint8_t *data, uint32_t len);
+
+/**	@brief  Mark the end of the data (producer side)
+ *	@param  pipe Pointer to rboot_pipe structure defining the pipeline
+ *	@retval bool False if the write has already failed
+ *  @note   The producer is notified once the rest has been written, result
+ *          is then RBOOT_PIPE_DONE or RBOOT_PIPE_ERROR.
+*/
+bool ICACHE_FLASH_ATTR rboot_pipe_close(rboot_pipe *pipe);
+
+/**	@brief  Write out the pipeline's data (writer side)
+ *	@param  pipe Pointer to rboot_pipe structure defining the pipeline
+ *	@retval bool False if a write has failed
+ *  @note   Call from the writer task each time it is notified. Writes whole
+ *          pages, up to a sector per flash write, until less than a page is
+ *          left (or everything, once closed).
+*/
+bool ICACHE_FLASH_ATTR rboot_pipe_service(rboot_pipe *pipe);
+#endif
+
+#ifdef BOOT_MMAP_READ
+/**	@brief  Read flash data through the memory mapping, from any segment
+ *	@param  addr Flash address to read from, any alignment
+ *	@param  data Buffer for the data, in dram, any alignment
+ *	@param  len Length to read
+ *	@retval bool False if the mapping isn't set up yet or a mapped read is
+ *          already in progress
+ *  @note   In rboot-bigflash.c, in iram. Data in the segment the code runs
+ *          from is read directly. For other segments, a chunk at a time
+ *          (RBOOT_MMAP_CHUNK bytes, default 4KB), interrupts are locked out,
+ *          the segment is mapped in place of the code, the chunk is copied
+ *          and the code's segment is mapped again. The flash cache starts
+ *          cold after each switch, so this pays off for bulk reads.
+*/
+bool rboot_mmap_read(uint32_t addr, void *data, uint32_t len);
+
+/**	@brief  Run a function with another flash segment mapped
+ *	@param  addr Flash address of the data
+ *	@param  func Function to run, passed the mapped address of addr
+ *	@param  arg Passed to func
+ *	@retval bool False if the mapping isn't set up yet or a mapped read is
+ *          already in progress
+ *  @note   For lookups in place, e.g. a search of a table, without copying it
+ *          out. Interrupts are locked out while func runs, so it must be
+ *          short, and it and anything it calls must be in iram with any
+ *          other data it uses in dram. Only 32 bit loads from the mapping
+ *          work, and only the 1MB segment holding addr is mapped.
+*/
+bool rboot_mmap_run(uint32_t addr, rboot_mmap_func func, void *arg);
+#endif
+
+#ifdef BOOT_READ_CACHE
+/**	@brief  Set up the flash read cache
+ *	@param  budget Bytes of heap to use, including the line tags
+ *	@retval bool False if the budget is too small for a line or can't be allocated
+ *  @note   Replaces any existing cache, and clears the statistics.
+*/
+bool ICACHE_FLASH_ATTR rboot_cache_init(uint32_t budget);
+
+/**	@brief  Free the flash read cache
+*/
+void ICACHE_FLASH_ATTR rboot_cache_free(void);
+
+/**	@brief  Read from the flash through the read cache
+ *	@param  addr Flash address to read from, any alignment
+ *	@param  data Buffer for the data, any alignment
+ *	@param  len Length to read
+ *	@retval bool False if the cache isn't set up or a flash read failed
+ *  @note   Lines not in the cache are read from the flash, evicting the least
+ *          recently used. When a miss is for the line after the last miss
+ *          the next RBOOT_CACHE_AHEAD lines are read with it, in one flash
+ *          read. Not for use from interrupts or by more than one task.
+*/
+bool ICACHE_FLASH_ATTR rboot_cache_read(uint32_t addr, void *data, uint32_t len);
+
+/**	@brief  Drop any cached lines for an area of the flash
+ *	@param  addr Flash address of the start of the area
+ *	@param  len Length of the area
+ *  @note   Called for you by every function in this api that writes to the
+ *          flash (rboot_set_config and so every config update, the ota,
+ *          pipeline, chunk, bundle, copy, scrub repair and hibernate
+ *          writers), call it after writing the flash any other way.
+*/
+void ICACHE_FLASH_ATTR rboot_cache_invalidate(uint32_t addr, uint32_t len);
+
+/**	@brief  Get the statistics for the flash read cache
+ *	@param  stats Structure to fill in, counts since rboot_cache_init
+*/
+void ICACHE_FLASH_ATTR rboot_cache_get_stats(rboot_cache_stats *stats);
+#endif
+
+#ifdef BOOT_OVERLAY
+/**	@brief  Load a section of an overlay image into the iram overlay window
+ *	@param  addr Flash address of the overlay image
+ *	@param  id Index of the section in the image to load
+ *	@retval bool True if the section is now resident in the window
+ *  @note   An overlay image is a normal rBoot (esptool2 -boot0) image whose
+ *          sections are linked to run in the window defined by
+ *          RBOOT_OVERLAY_ADDR and RBOOT_OVERLAY_LEN. Only the requested
+ *          section is copied to iram, but the whole image is read to check
+ *          its checksum. Nothing is loaded if the section is already
+ *          resident. Don't call this while code in the window is running.
+*/
+bool ICACHE_FLASH_ATTR rboot_load_overlay(uint32_t addr, uint8_t id);
+
+/**	@brief  Find which overlay section is resident in the iram window
+ *	@param  addr Pointer to uint32_t to populate with the overlay image address
+ *	@param  id Pointer to uint8_t to populate with the section index
+ *	@retval bool True if an overlay is resident, false if the window is free
+*/
+bool ICACHE_FLASH_ATTR rboot_get_overlay(uint32_t *addr, uint8_t *id);
+
+/**	@brief  Mark the iram overlay window as free
+ *  @note   Call before using the window for anything else, so a later
+ *          rboot_load_overlay will reload the overlay.
+*/
+void ICACHE_FLASH_ATTR rboot_unload_overlay(void);
+#endif
+
+#ifdef BOOT_MANIFEST
+/**	@brief  Start scrubbing a rom against its sector crc manifest
+ *	@param  status Pointer to rboot_scrub_status structure to initialise
+ *	@param  rom Index of the rom to check
+ *	@retval bool True if the rom has an intact manifest
+*/
+bool ICACHE_FLASH_ATTR rboot_scrub_init(rboot_scrub_status *status, uint8_t rom);
+
+/**	@brief  Check the next few sectors of a rom against its manifest
+ *	@param  status Pointer to rboot_scrub_status structure defining the scrub status
+ *	@param  sectors Maximum number of sectors to check in this call
+ *	@retval bool True unless a flash read failed
+ *  @note   Call from an idle task or timer to spread the cost of checking a
+ *          rom over time. Mismatching sectors are recorded in the status.
+*/
+bool ICACHE_FLASH_ATTR rboot_scrub_step(rboot_scrub_status *status, uint16_t sectors);
+
+/**	@brief  Rewrite the bad sectors found by the scrubber
+ *	@param  status Pointer to rboot_scrub_status structure defining the scrub status
+ *	@param  fetch Function to fetch the correct data for part of the image
+ *	@param  arg User argument passed to the fetch function
+ *	@retval bool True if all the bad sectors were repaired
+ *  @note   Only the bad sectors are fetched and rewritten, each is checked
+ *          against the manifest again afterwards. Do not repair the rom you
+ *          are running from.
+*/
+bool ICACHE_FLASH_ATTR rboot_scrub_repair(rboot_scrub_status *status, rboot_fetch_func fetch, void *arg);
+#endif
+
+#ifdef BOOT_INSTALLER
+/**	@brief  Ask rBoot to install a staged update on the next boot
+ *	@param  addr Flash address of the install payload (made with rboot-payload)
+ *	@param  len Length of the install payload
+ *	@param  rom Index of the rom to install to
+ *	@retval bool True on success
+ *  @note   The payload can be written anywhere outside the target rom's
+ *          area, e.g. with rboot_write_flash, and any copies it makes from
+ *          an existing rom must also be from outside that area. The target
+ *          is made the current rom, so it will be booted once installed (or
+ *          the previous good rom will be if the install fails).
+*/
+bool ICACHE_FLASH_ATTR rboot_set_install(uint32_t addr, uint32_t len, uint8_t rom);
+#endif
+
+#ifdef BOOT_BUNDLE
+/**	@brief  Start writing a bundle of images
+ *	@param  status Pointer to rboot_bundle_status structure to initialise
+*/
+void ICACHE_FLASH_ATTR rboot_bundle_init(rboot_bundle_status *status);
+
+/**	@brief  Write the next block of a bundle stream
+ *	@param  status Pointer to rboot_bundle_status structure defining the bundle status
+ *  @param  data Pointer to the next block of the bundle
+ *  @param  len Length of the block
+ *	@retval bool False if the bundle is invalid or a write failed
+ *  @note   Call with each block of the bundle as it arrives, in order. Each
+ *          part is written to its rom slot (or address) and checked against
+ *          its digest as soon as it is complete. No part may be written
+ *          over rBoot, its config, the current rom's slot or past the end
+ *          of the flash, the whole bundle is refused if one would be.
+*/
+bool ICACHE_FLASH_ATTR rboot_bundle_write(rboot_bundle_status *status, uint8_t *data, uint16_t len);
+
+/**	@brief  Finish writing a bundle
+ *	@param  status Pointer to rboot_bundle_status structure defining the bundle status
+ *	@retval bool True if all parts were received and checked, and the config updated
+ *  @note   Updates the config once for the whole bundle, selecting the rom
+ *          to boot (and recording digests, with BOOT_ROM_DIGEST).
+*/
+bool ICACHE_FLASH_ATTR rboot_bundle_end(rboot_bundle_status *status);
+#endif
+
+#ifdef BOOT_HIBERNATE
+/**	@brief  Save a snapshot to resume from on the next deep sleep wake
+ *	@param  addr Flash address to save the snapshot to (sector aligned)
+ *	@param  regions Array of dram regions to save
+ *	@param  count Number of regions
+ *	@param  resume Function rBoot will jump to, instead of the rom's entry point
+ *	@retval bool True if the snapshot was saved and stamped in rtc memory
+ *  @note   The snapshot is a normal rom image, the running rom's sections
+ *          followed by the regions, so rBoot checks and loads it in the
+ *          usual way. It is only resumed on a deep sleep wake, and only in
+ *          place of the rom it was taken from, any other reset (or a temp or
+ *          gpio boot) discards it. Call just before system_deep_sleep, with
+ *          nothing else changing the regions. No heap is used.
+ *  @note   Sdk and hardware state is not saved. resume must be in iram, and
+ *          must set up the flash cache mapping (as call_user_start in
+ *          rboot-bigflash.c does) before running any flash code.
+*/
+bool ICACHE_FLASH_ATTR rboot_hibernate_save(uint32_t addr, const rboot_hibernate_region *regions,
+	uint8_t count, void (*resume)(void));
+
+/**	@brief  Discard any saved hibernate snapshot
+ *	@retval bool True on success
+ *  @note   The next deep sleep wake will boot the rom normally.
+*/
+bool ICACHE_FLASH_ATTR rboot_hibernate_clear(void);
+#endif
+
+#ifdef BOOT_RESET_ROUTING
+/**	@brief  Set the rom rBoot boots after a particular type of reset
+ *	@param  reason Reset reason (sdk rst_reason value, e.g. REASON_DEEP_SLEEP_AWAKE)
+ *	@param  rom Rom slot to boot, or RBOOT_NO_ROUTE to use the current rom
+ *	@retval bool True on success
+ *  @note   e.g. route deep sleep wakes to a small sensor only image, and
+ *          everything else to the full app. The current rom is not changed,
+ *          it is still booted for reasons without a rom, and if the routed
+ *          rom is bad. GPIO and temp boots take priority. The first call
+ *          enables routing (MODE_REASON_ROM) with no other reasons routed.
+*/
+bool ICACHE_FLASH_ATTR rboot_set_reason_rom(uint8_t reason, uint8_t rom);
+#endif
+
+#ifdef BOOT_SIGNATURE
+/**	@brief  Verify the signature of a rom and record an attestation
+ *	@param  rom Index of the rom to verify
+ *	@param  verify Signature check function
+ *	@param  arg User argument passed to the verify function
+ *	@retval bool True if the signature is valid and the attestation was saved
+ *  @note   Call once after writing a new rom (after rboot_write_end). rBoot
+ *          will not boot a rom rewritten with rboot_write_flash until it has
+ *          been verified, but does not repeat the check at boot time.
+ *  @note   Requires rboot-sha256.c to be built into the app.
+*/
+bool ICACHE_FLASH_ATTR rboot_verify_rom(uint8_t rom, rboot_verify_func verify, void *arg);
+#endif
+
+#ifdef BOOT_ROM_DIGEST
+/**	@brief  Find a rom slot holding the image with a specified digest
+ *	@param  digest SHA-256 digest of the image (RBOOT_DIGEST_LEN bytes)
+ *	@param  rom Pointer to rom slot number variable to populate
+ *	@retval bool True if a matching rom was found
+ *  @note   Digests are recorded when a rom slot is written through this api
+ *          (rboot_write_end or rboot_chunk_end), so if the image is already on
+ *          the flash it can be booted (or copied) rather than downloaded again.
+*/
+bool ICACHE_FLASH_ATTR rboot_find_rom(const uint8_t *digest, uint8_t *rom);
+#endif
+
 #ifdef BOOT_RTC_ENABLED
 /** @brief  Get rBoot status/control data from RTC data area
  *  @param  rtc Pointer to a rboot_rtc_data structure to be populated
@@ -135,6 +840,15 @@ bool ICACHE_FLASH_ATTR rboot_get_last_boot_rom(uint8_t *rom);
  *          MODE_TEMP_ROM.
 */
 bool ICACHE_FLASH_ATTR rboot_get_last_boot_mode(uint8_t *mode);
+
+#ifdef BOOT_RESET_ROUTING
+/** @brief  Get the reset reason rBoot saw for the last boot
+ *  @param  reason Pointer to reset reason variable to populate
+ *  @retval bool True on success, false if no data/invalid checksum
+ *  @note   The boot mode includes MODE_REASON_ROM if the reason chose the rom.
+*/
+bool ICACHE_FLASH_ATTR rboot_get_last_boot_reason(uint8_t *reason);
+#endif
 #endif
 
 #ifdef __cplusplus
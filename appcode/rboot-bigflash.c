@@ -9,6 +9,21 @@
 
 #ifdef BOOT_BIG_FLASH
 
+#ifdef BOOT_MMAP_READ
+#include <c_types.h>
+#include "rboot-api.h"
+#endif
+
+#ifdef RBOOT_LAYOUT
+// slot table and mmap values checked and worked out at compile time
+#include <rboot-layout-app.h>
+#endif
+
+#ifdef RBOOT_PREWARM
+// hottest irom cache lines of the app, made by rboot-prewarm from a profile
+#include <rboot-prewarm-app.h>
+#endif
+
 // plain sdk defaults to iram
 #ifndef IRAM_ATTR
 #define IRAM_ATTR
@@ -26,15 +41,32 @@ extern void Cache_Read_Enable(uint32_t, uint32_t, uint32_t);
 uint8_t rBoot_mmap_1 = 0xff;
 uint8_t rBoot_mmap_2 = 0xff;
 
+#ifdef BOOT_MMAP_READ
+extern void ets_intr_lock(void);
+extern void ets_intr_unlock(void);
+
+// flash is mapped here, a 1MB segment at a time
+#define RBOOT_MMAP_WINDOW  0x40200000
+#define RBOOT_MMAP_SEGMENT 0x100000
+// most read with interrupts locked out in one go
+#ifndef RBOOT_MMAP_CHUNK
+#define RBOOT_MMAP_CHUNK 4096
+#endif
+
+static uint8_t rBoot_mmap_busy = 0;
+#endif
+
 // this function must remain in iram
 void IRAM_ATTR Cache_Read_Enable_New(void);
 void IRAM_ATTR Cache_Read_Enable_New(void) {
 	
 	if (rBoot_mmap_1 == 0xff) {
 		uint32_t val;
+#if !defined(RBOOT_LAYOUT) || !defined(BOOT_RTC_ENABLED)
 		rboot_config conf;
 
 		SPIRead(BOOT_CONFIG_SECTOR * SECTOR_SIZE, &conf, sizeof(rboot_config));
+#endif
 
 #ifdef BOOT_RTC_ENABLED
 		// rtc support here isn't written ideally, we don't read the whole structure and
@@ -53,23 +85,114 @@ void IRAM_ATTR Cache_Read_Enable_New(void) {
 		val = *rtcd;
 		// extract the one of interest
 		val = ((uint8_t*)&val)[off & 3];
-		// get address of rom
-		val = conf.roms[val];
 #else
-		val = conf.roms[conf.current_rom];
+		val = conf.current_rom;
 #endif
 
-		val /= 0x100000;
+#ifdef RBOOT_LAYOUT
+		rBoot_mmap_2 = rboot_layout_slots[val].mmap_2;
+		rBoot_mmap_1 = rboot_layout_slots[val].mmap_1;
+#else
+		// get address of rom
+		val = conf.roms[val] / 0x100000;
 
 		rBoot_mmap_2 = val / 2;
 		rBoot_mmap_1 = val % 2;
+#endif
 		
 		//ets_printf("mmap %d,%d,1\r\n", rBoot_mmap_1, rBoot_mmap_2);
+
+#ifdef RBOOT_PREWARM
+		// on startup, pull the app's hot code into the cache in flash order,
+		// rather than a miss at a time as it first runs (done here as this
+		// is called before .bss is cleared, rBoot_mmap_1 is in .data)
+		Cache_Read_Enable(rBoot_mmap_1, rBoot_mmap_2, 1);
+		for (val = 0; val < RBOOT_PREWARM_COUNT; val++) {
+			(void)*(volatile uint32_t*)rboot_prewarm_lines[val];
+		}
+		return;
+#endif
 	}
 	
 	Cache_Read_Enable(rBoot_mmap_1, rBoot_mmap_2, 1);
 }
 
+#ifdef BOOT_MMAP_READ
+// copy out of the mapped window, which only allows 32 bit loads
+static void IRAM_ATTR mmap_copy(uint32_t offset, uint8_t *data, uint32_t len) {
+	volatile uint32_t *src = (volatile uint32_t*)(RBOOT_MMAP_WINDOW + (offset & ~3));
+	uint32_t skew = offset & 3;
+	uint32_t word;
+
+	if (skew == 0 && ((uint32_t)data & 3) == 0) {
+		for (; len >= 4; len -= 4, data += 4) {
+			*(uint32_t*)data = *src++;
+		}
+	}
+	while (len > 0) {
+		word = *src++ >> (skew * 8);
+		for (; skew < 4 && len > 0; skew++, len--) {
+			*data++ = word & 0xff;
+			word >>= 8;
+		}
+		skew = 0;
+	}
+}
+
+// map the segment holding addr in place of the code, with interrupts
+// locked out as their handlers may be in flash, and restore it after
+static bool IRAM_ATTR mmap_enter(uint32_t addr) {
+	if (rBoot_mmap_1 == 0xff || rBoot_mmap_busy) {
+		return false;
+	}
+	ets_intr_lock();
+	rBoot_mmap_busy = 1;
+	Cache_Read_Disable();
+	Cache_Read_Enable((addr / RBOOT_MMAP_SEGMENT) % 2, (addr / RBOOT_MMAP_SEGMENT) / 2, 1);
+	return true;
+}
+
+static void IRAM_ATTR mmap_leave(void) {
+	Cache_Read_Disable();
+	Cache_Read_Enable(rBoot_mmap_1, rBoot_mmap_2, 1);
+	rBoot_mmap_busy = 0;
+	ets_intr_unlock();
+}
+
+bool IRAM_ATTR rboot_mmap_read(uint32_t addr, void *data, uint32_t len) {
+	uint32_t offset;
+	uint32_t chunk;
+
+	while (len > 0) {
+		offset = addr % RBOOT_MMAP_SEGMENT;
+		chunk = RBOOT_MMAP_SEGMENT - offset;
+		if (chunk > RBOOT_MMAP_CHUNK) chunk = RBOOT_MMAP_CHUNK;
+		if (chunk > len) chunk = len;
+		if ((addr / RBOOT_MMAP_SEGMENT) == (rBoot_mmap_2 * 2) + rBoot_mmap_1 && !rBoot_mmap_busy) {
+			// the code's own segment, already mapped
+			mmap_copy(offset, (uint8_t*)data, chunk);
+		} else {
+			if (!mmap_enter(addr)) return false;
+			mmap_copy(offset, (uint8_t*)data, chunk);
+			mmap_leave();
+		}
+		data = (uint8_t*)data + chunk;
+		addr += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+bool IRAM_ATTR rboot_mmap_run(uint32_t addr, rboot_mmap_func func, void *arg) {
+	if (!mmap_enter(addr)) {
+		return false;
+	}
+	func((const void*)(RBOOT_MMAP_WINDOW + (addr % RBOOT_MMAP_SEGMENT)), arg);
+	mmap_leave();
+	return true;
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
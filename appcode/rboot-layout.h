@@ -0,0 +1,109 @@
+#ifndef __RBOOT_LAYOUT_H__
+#define __RBOOT_LAYOUT_H__
+
+//////////////////////////////////////////////////
+// rBoot compile time flash layout for C++ apps.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Describe the rom slots as constexpr data and check them with
+// RBOOT_LAYOUT_CHECK, so a bad layout fails the build rather than the
+// boot. e.g. in rboot-layout-app.h:
+//
+//   #include <rboot-layout.h>
+//   constexpr rboot_slot rboot_layout_slots[] = {
+//       rboot_layout_slot(0x002000, 0x0fe000),
+//       rboot_layout_slot(0x102000, 0x0fe000),
+//   };
+//   RBOOT_LAYOUT_CHECK(rboot_layout_slots, 0x400000);
+//
+// Define RBOOT_LAYOUT when building rboot-bigflash.c (as C++) to have it
+// use the precomputed mmap values from this table.
+
+#ifndef __cplusplus
+#error "rboot-layout.h can only be used from C++"
+#endif
+
+#include <stddef.h>
+#include <string.h>
+#include <rboot.h>
+
+// flash is memory mapped in segments of this size (with BOOT_BIG_FLASH)
+#define RBOOT_MMAP_SEGMENT 0x100000
+
+/**	@brief  A rom slot, with the cache mapping needed to run code from it
+ *  @note   Create with rboot_layout_slot, so mmap_1 and mmap_2 are worked out
+ *          at compile time.
+*/
+typedef struct {
+	uint32_t addr;   ///< Flash address of the slot
+	uint32_t size;   ///< Size of the slot
+	uint8_t mmap_1;  ///< Cache_Read_Enable odd_even parameter for the slot
+	uint8_t mmap_2;  ///< Cache_Read_Enable mb_count parameter for the slot
+} rboot_slot;
+
+constexpr rboot_slot rboot_layout_slot(uint32_t addr, uint32_t size) {
+	return { addr, size, (uint8_t)((addr / RBOOT_MMAP_SEGMENT) % 2), (uint8_t)((addr / RBOOT_MMAP_SEGMENT) / 2) };
+}
+
+template <size_t N>
+constexpr size_t rboot_layout_count(const rboot_slot (&)[N]) {
+	return N;
+}
+
+// whole sectors, starting on a sector boundary
+constexpr bool rboot_layout_aligned(const rboot_slot *slot, size_t count) {
+	return count == 0 || ((slot->addr % SECTOR_SIZE) == 0 && (slot->size % SECTOR_SIZE) == 0 &&
+		slot->size != 0 && rboot_layout_aligned(slot + 1, count - 1));
+}
+
+// after the config sector and within the flash
+constexpr bool rboot_layout_inside(const rboot_slot *slot, size_t count, uint32_t flashsize) {
+	return count == 0 || (slot->addr >= SECTOR_SIZE * (BOOT_CONFIG_SECTOR + 1) && slot->addr <= flashsize &&
+		slot->size <= flashsize - slot->addr && rboot_layout_inside(slot + 1, count - 1, flashsize));
+}
+
+// within a single memory mapped segment
+constexpr bool rboot_layout_unsplit(const rboot_slot *slot, size_t count) {
+	return count == 0 || ((slot->addr / RBOOT_MMAP_SEGMENT) == ((slot->addr + slot->size - 1) / RBOOT_MMAP_SEGMENT) &&
+		rboot_layout_unsplit(slot + 1, count - 1));
+}
+
+constexpr bool rboot_layout_clear_of(const rboot_slot *slot, const rboot_slot *other, size_t count) {
+	return count == 0 || ((slot->addr + slot->size <= other->addr || other->addr + other->size <= slot->addr) &&
+		rboot_layout_clear_of(slot, other + 1, count - 1));
+}
+
+// no two slots overlap
+constexpr bool rboot_layout_disjoint(const rboot_slot *slot, size_t count) {
+	return count == 0 || (rboot_layout_clear_of(slot, slot + 1, count - 1) && rboot_layout_disjoint(slot + 1, count - 1));
+}
+
+#define RBOOT_LAYOUT_CHECK(slots, flashsize) \
+	static_assert(rboot_layout_count(slots) <= MAX_ROMS, "rBoot layout has more slots than MAX_ROMS"); \
+	static_assert(rboot_layout_aligned(slots, rboot_layout_count(slots)), "rBoot layout slots must be whole, sector aligned, sectors"); \
+	static_assert(rboot_layout_inside(slots, rboot_layout_count(slots), flashsize), "rBoot layout slots must be after the config sector and within the flash"); \
+	static_assert(rboot_layout_unsplit(slots, rboot_layout_count(slots)), "rBoot layout slots must not straddle a 1MB boundary"); \
+	static_assert(rboot_layout_disjoint(slots, rboot_layout_count(slots)), "rBoot layout slots must not overlap")
+
+/**	@brief  Fill in a default config from a layout
+ *	@param  slots The layout
+ *	@param  conf Config to populate, e.g. to pass to rboot_set_config
+ *  @note   The rest of the config is cleared, the checksum (if enabled) is
+ *          added by rboot_set_config.
+*/
+template <size_t N>
+inline void rboot_layout_config(const rboot_slot (&slots)[N], rboot_config *conf) {
+	size_t loop;
+	memset(conf, 0x00, sizeof(rboot_config));
+	conf->magic = BOOT_CONFIG_MAGIC;
+	conf->version = BOOT_CONFIG_VERSION;
+	conf->count = N;
+	for (loop = 0; loop < N; loop++) {
+		conf->roms[loop] = slots[loop].addr;
+	}
+}
+
+#endif
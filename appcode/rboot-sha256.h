@@ -0,0 +1,36 @@
+#ifndef __RBOOT_SHA256_H__
+#define __RBOOT_SHA256_H__
+
+//////////////////////////////////////////////////
+// SHA-256 for the rBoot API.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHA256_DIGEST_LEN 32
+
+/**	@brief  SHA-256 hashing context
+ *  @note   Treat as opaque, use the rboot_sha256_* functions.
+*/
+typedef struct {
+	uint32_t state[8];
+	uint32_t count;
+	uint8_t buffer[64];
+} rboot_sha256_ctx;
+
+void rboot_sha256_init(rboot_sha256_ctx *ctx);
+void rboot_sha256_update(rboot_sha256_ctx *ctx, const uint8_t *data, uint32_t len);
+void rboot_sha256_final(rboot_sha256_ctx *ctx, uint8_t *digest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,6 +30,60 @@ extern void ets_printf(char*, ...);
 extern void ets_delay_us(int);
 extern void ets_memset(void*, uint8_t, uint32_t);
 extern void ets_memcpy(void*, const void*, uint32_t);
+extern void uart_div_modify(uint8_t, uint32_t);
+#ifdef BOOT_CHKSUM_MAPPED
+extern void Cache_Read_Enable(uint32_t, uint32_t, uint32_t);
+extern void Cache_Read_Disable(void);
+
+// flash is mapped here, 1MB at a time, once the cache is enabled
+#define FLASH_MAP_ADDR 0x40200000
+#define FLASH_MAP_SIZE 0x100000
+#endif
+
+#ifdef BOOT_INSTALLER
+extern uint32_t SPIEraseBlock(uint32_t);
+
+#define BLOCK_SIZE 0x10000
+
+// install payload, a header followed by a list of ops that
+// build the new rom in order, ending with INSTALL_OP_END
+#define INSTALL_MAGIC 0x4c534e49
+#define INSTALL_OP_END     0x00
+#define INSTALL_OP_LITERAL 0x01 // len bytes follow the op, padded to 4
+#define INSTALL_OP_COPY    0x02 // len bytes from flash at addr
+#define INSTALL_OP_FILL    0x03 // len bytes of value fill
+
+typedef struct {
+	uint32_t magic;
+	uint32_t length; // of the rom to be built
+} install_header;
+
+typedef struct {
+	uint8_t type;
+	uint8_t fill;
+	uint16_t unused;
+	uint32_t len;
+	uint32_t addr;
+} install_op;
+#endif
+
+#ifdef BOOT_RECOVERY
+// recovery frames from the host, each answered with RECOVERY_SYNC,
+// RECOVERY_ACK or RECOVERY_NAK, seq:
+//   RECOVERY_SYNC, type, seq, len (16 bit), data, crc32 of type to data
+#define RECOVERY_SYNC  0xa5
+#define RECOVERY_ACK   0x06
+#define RECOVERY_NAK   0x15
+#define RECOVERY_START 'S' // stage addr, payload length (32 bit), rom
+#define RECOVERY_DATA  'D' // next part of the payload, a multiple of 4 bytes
+#define RECOVERY_END   'E' // install the staged payload to the rom
+#define RECOVERY_BLOCK 0x400 // max data in a frame
+#endif
+
+#ifdef BOOT_STAGE2A_RELOCATE
+// end of rBoot's own code in iram (from the linker script)
+extern uint32_t _text_end;
+#endif
 
 // functions we'll call by address
 typedef void stage2a(uint32_t);
@@ -42,11 +96,11 @@ typedef struct {
 	uint8_t count;
 	uint8_t flags1;
 	uint8_t flags2;
-	usercode* entry;
+	uint32_t entry;
 } rom_header;
 
 typedef struct {
-	uint8_t* address;
+	uint32_t address;
 	uint32_t length;
 } section_header;
 
@@ -11,6 +11,10 @@
 
 #include "rboot-private.h"
 
+// with BOOT_STAGE2A_RELOCATE this code is copied to wherever there is
+// room in iram, so it must only refer to itself pc relatively (calls
+// within .text and l32r literals are), and keep no data of its own
+
 usercode* NOINLINE load_rom(uint32_t readpos) {
 	
 	uint8_t sectcount;
@@ -26,7 +30,7 @@ usercode* NOINLINE load_rom(uint32_t readpos) {
 	readpos += sizeof(rom_header);
 
 	// create function pointer for entry point
-	usercode = header.entry;
+	usercode = (void*)header.entry;
 	
 	// copy all the sections
 	for (sectcount = header.count; sectcount > 0; sectcount--) {
@@ -36,7 +40,7 @@ usercode* NOINLINE load_rom(uint32_t readpos) {
 		readpos += sizeof(section_header);
 
 		// get section address and length
-		writepos = section.address;
+		writepos = (uint8_t*)section.address;
 		remaining = section.length;
 		
 		while (remaining > 0) {
@@ -8,11 +8,53 @@
 #include "rboot-private.h"
 #include <rboot-hex2a.h>
 
+#ifdef BOOT_STAGE2A_RELOCATE
+// where stage2a has been placed for the rom being booted
+uint32_t stage2a_entry;
+#endif
+
 #ifndef UART_CLK_FREQ
 // reset apb freq = 2x crystal freq: http://esp8266-re.foogod.com/wiki/Serial_UART
 #define UART_CLK_FREQ	(26000000 * 2)
 #endif
 
+#ifdef BOOT_CHKSUM_MAPPED
+// xor together all the whole words of a section, reading them through the
+// flash cache, selecting each 1MB of flash in turn if it crosses a boundary
+// returns the number of bytes processed and adds them to the chksum
+static uint32_t chksum_mapped(uint32_t readpos, uint32_t len, uint8_t *chksum) {
+
+	uint32_t sum = 0;
+	uint32_t done = 0;
+	uint32_t count;
+	uint32_t mb;
+	volatile uint32_t *mapped;
+
+	len &= ~3;
+	while (done < len) {
+		// map the 1MB of flash containing readpos
+		mb = readpos / FLASH_MAP_SIZE;
+		Cache_Read_Enable(mb % 2, mb / 2, 1);
+		mapped = (volatile uint32_t*)(FLASH_MAP_ADDR + (readpos % FLASH_MAP_SIZE));
+		// words up to the end of the section or of this 1MB
+		count = FLASH_MAP_SIZE - (readpos % FLASH_MAP_SIZE);
+		if (count > len - done) count = len - done;
+		readpos += count;
+		done += count;
+		for (count /= 4; count > 0; count--) {
+			sum ^= *mapped++;
+		}
+		Cache_Read_Disable();
+	}
+
+	// fold the word sum to a byte
+	sum ^= sum >> 16;
+	sum ^= sum >> 8;
+	*chksum ^= (uint8_t)sum;
+	return done;
+}
+#endif
+
 static uint32_t check_image(uint32_t readpos) {
 
 	uint8_t buffer[BUFFER_SIZE];
@@ -76,6 +118,14 @@ static uint32_t check_image(uint32_t readpos) {
 		// get section address and length
 		remaining = section->length;
 
+#ifdef BOOT_CHKSUM_MAPPED
+		if ((readpos & 3) == 0) {
+			loop = chksum_mapped(readpos, remaining, &chksum);
+			readpos += loop;
+			remaining -= loop;
+		}
+#endif
+
 		while (remaining > 0) {
 			// work out how much to read, up to BUFFER_SIZE
 			uint32_t readlen = (remaining < BUFFER_SIZE) ? remaining : BUFFER_SIZE;
@@ -120,11 +170,14 @@ static uint32_t check_image(uint32_t readpos) {
 	return romaddr;
 }
 
-#if defined (BOOT_GPIO_ENABLED) || defined(BOOT_GPIO_SKIP_ENABLED)
+#if defined (BOOT_GPIO_ENABLED) || defined(BOOT_GPIO_SKIP_ENABLED) || defined(BOOT_RECOVERY_GPIO)
 
 #if BOOT_GPIO_NUM > 16
 #error "Invalid BOOT_GPIO_NUM value (disable BOOT_GPIO_ENABLED to disable this feature)"
 #endif
+#if defined(BOOT_RECOVERY_GPIO) && BOOT_RECOVERY_GPIO > 16
+#error "Invalid BOOT_RECOVERY_GPIO value"
+#endif
 
 // sample gpio code for gpio16
 #define ETS_UNCACHED_ADDR(addr) (addr)
@@ -181,6 +234,9 @@ static int get_gpio(int gpio_num) {
 	WRITE_PERI_REG(GPIO_ENABLE_OUT_ADDRESS, old_out);
 	return (result ? 1 : 0);
 }
+#endif
+
+#if defined (BOOT_GPIO_ENABLED) || defined(BOOT_GPIO_SKIP_ENABLED)
 
 // return '1' if we should do a gpio boot
 static int perform_gpio_boot(rboot_config *romconf) {
@@ -229,7 +285,7 @@ uint32_t system_rtc_mem(int32_t addr, void *buff, int32_t length, uint32_t mode)
 }
 #endif
 
-#ifdef BOOT_BAUDRATE
+#if defined(BOOT_BAUDRATE) || defined(BOOT_HIBERNATE) || defined(BOOT_RESET_ROUTING)
 static enum rst_reason get_reset_reason(void) {
 
 	// reset reason is stored @ offset 0 in system rtc memory
@@ -252,6 +308,358 @@ static uint8_t calc_chksum(uint8_t *start, uint8_t *end) {
 }
 #endif
 
+#ifdef BOOT_INSTALLER
+// write a page of the rom being installed, erasing ahead of it
+// a 64KB block at a time where possible, else a sector at a time
+static uint8_t install_page(uint32_t addr, void *page, uint32_t len, uint32_t *erased, uint32_t end) {
+	while (*erased < addr + len) {
+		if ((*erased % BLOCK_SIZE) == 0 && end - *erased >= BLOCK_SIZE) {
+			if (SPIEraseBlock(*erased / BLOCK_SIZE) != 0) return 0;
+			*erased += BLOCK_SIZE;
+		} else {
+			if (SPIEraseSector(*erased / SECTOR_SIZE) != 0) return 0;
+			*erased += SECTOR_SIZE;
+		}
+	}
+	return (SPIWrite(addr, page, len) == 0);
+}
+
+// build a rom from an install payload, a page at a time, copies are
+// only allowed from outside the area being written so if interrupted
+// the whole install can simply be run again on the next boot
+static uint8_t install_rom(rboot_install *install, uint32_t dst) {
+
+	uint32_t page[BUFFER_SIZE / 4];
+	uint32_t buffer[BUFFER_SIZE / 4];
+	install_header *header = (install_header*)buffer;
+	install_op op;
+	uint32_t length;
+	uint32_t readpos = install->addr;
+	uint32_t end = install->addr + install->len;
+	uint32_t area;
+	uint32_t outpos = 0;
+	uint32_t erased = dst;
+	uint32_t fill = 0;
+	uint32_t remaining;
+	uint32_t len;
+	uint32_t skew;
+
+	if (SPIRead(readpos, header, sizeof(install_header)) != 0 ||
+		header->magic != INSTALL_MAGIC || (dst % SECTOR_SIZE) != 0) {
+		return 0;
+	}
+	readpos += sizeof(install_header);
+	// buffer is reused below
+	length = header->length;
+	area = dst + ((length + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1));
+	if (install->addr < area && end > dst) {
+		// payload would be overwritten by the install
+		return 0;
+	}
+
+	while (1) {
+		if (readpos + sizeof(install_op) > end || SPIRead(readpos, &op, sizeof(install_op)) != 0) {
+			return 0;
+		}
+		readpos += sizeof(install_op);
+		if (op.type == INSTALL_OP_END) {
+			break;
+		}
+		if (op.len > length - outpos - fill) {
+			return 0;
+		}
+		if (op.type == INSTALL_OP_LITERAL) {
+			if (op.len > end - readpos) return 0;
+			op.addr = readpos;
+			readpos += (op.len + 3) & ~3;
+		} else if (op.type == INSTALL_OP_COPY) {
+			if (op.addr < area && op.addr + op.len > dst) return 0;
+		} else if (op.type != INSTALL_OP_FILL) {
+			return 0;
+		}
+
+		for (remaining = op.len; remaining > 0; remaining -= len) {
+			// as much as fits in the page, leaving room to word align reads
+			len = BUFFER_SIZE - fill;
+			if (len > BUFFER_SIZE - 4) len = BUFFER_SIZE - 4;
+			if (len > remaining) len = remaining;
+			if (op.type == INSTALL_OP_FILL) {
+				ets_memset((uint8_t*)page + fill, op.fill, len);
+			} else {
+				skew = op.addr & 3;
+				if (SPIRead(op.addr - skew, buffer, (skew + len + 3) & ~3) != 0) {
+					return 0;
+				}
+				ets_memcpy((uint8_t*)page + fill, (uint8_t*)buffer + skew, len);
+				op.addr += len;
+			}
+			fill += len;
+			if (fill == BUFFER_SIZE) {
+				if (!install_page(dst + outpos, page, BUFFER_SIZE, &erased, area)) return 0;
+				outpos += BUFFER_SIZE;
+				fill = 0;
+			}
+		}
+	}
+
+	if (outpos + fill != length) {
+		return 0;
+	}
+	if (fill > 0) {
+		ets_memset((uint8_t*)page + fill, 0xff, BUFFER_SIZE - fill);
+		if (!install_page(dst + outpos, page, (fill + 3) & ~3, &erased, area)) return 0;
+	}
+	return 1;
+}
+#endif
+
+#ifdef BOOT_RECOVERY
+// uart0, polled, the host sim replaces these
+#define UART0_FIFO   0x60000000
+#define UART0_CLKDIV 0x60000014
+#define UART0_STATUS 0x6000001c
+#define UART_REG(addr) (*((volatile uint32_t *)(addr)))
+#ifndef RECOVERY_RX_COUNT
+#define RECOVERY_RX_COUNT() (UART_REG(UART0_STATUS) & 0xff)
+#define RECOVERY_RX() (UART_REG(UART0_FIFO) & 0xff)
+#define RECOVERY_TX(c) do { while (((UART_REG(UART0_STATUS) >> 16) & 0xff) >= 126); UART_REG(UART0_FIFO) = (c); } while (0)
+// wait for the last byte to go before the baud rate is changed back
+#define RECOVERY_FLUSH() do { while ((UART_REG(UART0_STATUS) >> 16) & 0xff); ets_delay_us(100); } while (0)
+#define RECOVERY_TICK() ets_delay_us(100)
+#endif
+// ticks to wait for an image when no rom is good, 0 for ever
+#ifndef RECOVERY_FOREVER
+#define RECOVERY_FOREVER 0
+#endif
+// ticks allowed between bytes of a frame
+#define RECOVERY_BYTE_TICKS 1000
+
+// next byte from the uart, waiting up to ticks * 100us (0 for
+// ever), or -1 if nothing arrived in time
+static int32_t recovery_getc(uint32_t ticks) {
+	while (RECOVERY_RX_COUNT() == 0) {
+		if (ticks != 0 && --ticks == 0) return -1;
+		RECOVERY_TICK();
+	}
+	return RECOVERY_RX();
+}
+
+// bitwise crc32, small rather than fast, the uart is the limit
+static uint32_t recovery_crc(uint32_t crc, uint8_t byte) {
+	uint8_t bit;
+	crc ^= byte;
+	for (bit = 0; bit < 8; bit++) {
+		crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+	return crc;
+}
+
+static void recovery_reply(uint8_t reply, uint8_t seq) {
+	RECOVERY_TX(RECOVERY_SYNC);
+	RECOVERY_TX(reply);
+	RECOVERY_TX(seq);
+}
+
+// true if a flash area overlaps a rom slot, which runs up to the
+// start of the next slot or the end of its 1MB mapping segment
+static uint8_t in_slot(rboot_config *romconf, uint8_t rom, uint32_t addr, uint32_t len) {
+	uint32_t start = romconf->roms[rom];
+	uint32_t end = (start & ~0xfffff) + 0x100000;
+	uint8_t loop;
+
+	for (loop = 0; loop < romconf->count; loop++) {
+		if (romconf->roms[loop] > start && romconf->roms[loop] < end) end = romconf->roms[loop];
+	}
+	return (addr < end && start < addr + len);
+}
+
+// take an install payload (see rboot-recover) over the uart, stage it
+// in flash then install it to a rom like BOOT_INSTALLER, returns the
+// rom (now the current rom) or -1 if the uart was idle for timeout ticks,
+// the stage area must be clear of the keep rom's slot (-1 for none)
+static int32_t recovery(rboot_config *romconf, uint32_t flashsize, int32_t keep, uint32_t timeout) {
+
+	uint32_t frame[(RECOVERY_BLOCK + 4) / 4];
+	uint8_t *data = (uint8_t*)frame;
+	rboot_install install;
+	uint32_t div;
+	uint32_t crc;
+	uint32_t len;
+	uint32_t pos;
+	uint32_t written = 0;
+	uint32_t erased = 0;
+	int32_t c;
+	uint8_t type;
+	uint8_t seq;
+	uint8_t last = 0;
+	uint8_t started = 0;
+	uint8_t ok;
+	int32_t rom = -1;
+
+	ets_printf("Recovery, waiting for image at %d baud.\r\n", BOOT_RECOVERY_BAUD);
+	div = UART_REG(UART0_CLKDIV) & 0xfffff;
+	uart_div_modify(0, UART_CLK_FREQ / BOOT_RECOVERY_BAUD);
+
+	while (rom < 0) {
+		// only give up while idle between frames
+		if ((c = recovery_getc(timeout)) < 0) break;
+		if (c != RECOVERY_SYNC) continue;
+
+		// header then data and crc, a frame with a lost byte is dropped
+		// and the host sends it again when it gets no reply
+		crc = 0xffffffff;
+		for (pos = 0; pos < 4; pos++) {
+			if ((c = recovery_getc(RECOVERY_BYTE_TICKS)) < 0) break;
+			data[pos] = c;
+			crc = recovery_crc(crc, c);
+		}
+		if (c < 0) continue;
+		type = data[0];
+		seq = data[1];
+		len = data[2] | (data[3] << 8);
+		if (len > RECOVERY_BLOCK) {
+			recovery_reply(RECOVERY_NAK, seq);
+			continue;
+		}
+		for (pos = 0; pos < len + 4; pos++) {
+			if ((c = recovery_getc(RECOVERY_BYTE_TICKS)) < 0) break;
+			data[pos] = c;
+			if (pos < len) crc = recovery_crc(crc, c);
+		}
+		if (c < 0) continue;
+		if ((crc ^ 0xffffffff) != (data[len] | (data[len + 1] << 8) | (data[len + 2] << 16) | ((uint32_t)data[len + 3] << 24))) {
+			recovery_reply(RECOVERY_NAK, seq);
+			continue;
+		}
+
+		// repeat of a frame whose ack was lost (a start can always be redone)
+		if (started && seq == last && type != RECOVERY_START) {
+			recovery_reply(RECOVERY_ACK, seq);
+			continue;
+		}
+
+		ok = 0;
+		if (type == RECOVERY_START && len == 9) {
+			install.addr = frame[0];
+			install.len = frame[1];
+			install.rom = data[8];
+			// staged on the flash, clear of rBoot and its config, the slot
+			// being installed to and the rom to keep (checked now, the
+			// stage area is erased as the data arrives)
+			if (install.rom < romconf->count && (install.addr % SECTOR_SIZE) == 0 &&
+				install.addr >= SECTOR_SIZE * (BOOT_CONFIG_SECTOR + 1) && install.len != 0 &&
+				install.addr < flashsize && install.len <= flashsize - install.addr &&
+				!in_slot(romconf, install.rom, install.addr, install.len) &&
+				(keep < 0 || !in_slot(romconf, keep, install.addr, install.len))) {
+#ifdef BOOT_ROM_DIGEST
+				// forget the slot's digest before anything is erased, as
+				// the api does when the app installs (romconf is the
+				// start of the whole config sector)
+				ets_memset(romconf->digest[install.rom], 0, RBOOT_DIGEST_LEN);
+#ifdef BOOT_CONFIG_CHKSUM
+				romconf->chksum = calc_chksum((uint8_t*)romconf, (uint8_t*)&romconf->chksum);
+#endif
+				SPIEraseSector(BOOT_CONFIG_SECTOR);
+				SPIWrite(BOOT_CONFIG_SECTOR * SECTOR_SIZE, romconf, SECTOR_SIZE);
+#endif
+				started = 1;
+				written = 0;
+				erased = install.addr;
+				ok = 1;
+			}
+		} else if (type == RECOVERY_DATA && started && (len & 3) == 0 &&
+			len <= ((install.len + 3) & ~3) - written) {
+			ok = install_page(install.addr + written, frame, len, &erased,
+				install.addr + ((install.len + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1)));
+			if (ok) written += len;
+		} else if (type == RECOVERY_END && started && written >= install.len) {
+			started = 0;
+			if (install_rom(&install, romconf->roms[install.rom]) && check_image(romconf->roms[install.rom]) != 0) {
+				rom = install.rom;
+				ok = 1;
+			}
+		}
+		if (ok) last = seq;
+		recovery_reply(ok ? RECOVERY_ACK : RECOVERY_NAK, seq);
+	}
+
+	RECOVERY_FLUSH();
+	uart_div_modify(0, div);
+	if (rom < 0) {
+		ets_printf("Recovery timed out.\r\n");
+		return -1;
+	}
+	ets_printf("Recovery installed rom %d.\r\n", rom);
+	romconf->current_rom = rom;
+	return rom;
+}
+#endif
+
+// check a rom from the config is valid and, with signatures
+// enabled, that it has been verified since it was last written
+static uint32_t check_rom(rboot_config *romconf, int32_t rom) {
+	uint32_t loadAddr;
+#ifdef BOOT_SIGNATURE
+	uint8_t gen;
+#endif
+
+	loadAddr = check_image(romconf->roms[rom]);
+
+#ifdef BOOT_SIGNATURE
+	// generation 0 is a factory installed rom, never rewritten by the app
+	gen = romconf->generation[rom];
+	if (loadAddr != 0 && gen != 0 &&
+		(romconf->attest[rom].rom != rom || romconf->attest[rom].generation != gen)) {
+		ets_printf("Rom %d is not verified.\r\n", rom);
+		return 0;
+	}
+#endif
+
+	return loadAddr;
+}
+
+#ifdef BOOT_STAGE2A_RELOCATE
+// find somewhere in iram for stage2a that the rom won't load over, it
+// starts at its linked address at the top of iram and is moved down
+// below any section in the way, but must stay above rBoot's own code
+// (still running when stage2a is copied), returns 0 if there's no room
+static uint32_t place_stage2a(uint32_t readpos) {
+
+	rom_header header;
+	section_header section;
+	uint32_t addr = _text_addr;
+	uint32_t len = (_text_len + 0x0f) & ~0x0f;
+	uint32_t pos;
+	uint8_t count;
+	uint8_t clear;
+
+	if (SPIRead(readpos, &header, sizeof(rom_header)) != 0) {
+		return 0;
+	}
+
+	do {
+		clear = 1;
+		pos = readpos + sizeof(rom_header);
+		for (count = header.count; count > 0 && clear; count--) {
+			if (SPIRead(pos, &section, sizeof(section_header)) != 0) {
+				return 0;
+			}
+			pos += sizeof(section_header) + section.length;
+			if (section.address < addr + len &&
+				section.address + section.length > addr) {
+				// in the way, try again just below it, stage2a only
+				// uses pc relative references to itself so it can run
+				// anywhere 16 byte aligned
+				addr = (section.address - len) & ~0x0f;
+				clear = 0;
+			}
+		}
+	} while (!clear && addr >= (uint32_t)&_text_end);
+
+	return clear ? addr : 0;
+}
+#endif
+
 #ifndef BOOT_CUSTOM_DEFAULT_CONFIG
 // populate the user fields of the default config
 // created on first boot or in case of corruption
@@ -290,6 +698,20 @@ uint32_t NOINLINE find_image(void) {
 	rboot_rtc_data rtc;
 	uint8_t temp_boot = 0;
 #endif
+#ifdef BOOT_HIBERNATE
+	rboot_hibernate_data hib;
+	uint8_t resumed = 0;
+#endif
+#ifdef BOOT_RESET_ROUTING
+	uint8_t reason;
+	uint8_t routed = 0;
+#endif
+#ifdef BOOT_STAGE2A_RELOCATE
+	uint32_t stage2aAddr;
+#endif
+#ifdef BOOT_RECOVERY
+	uint32_t chipsize;
+#endif
 
 	rboot_config *romconf = (rboot_config*)buffer;
 	rom_header *header = (rom_header*)buffer;
@@ -325,37 +747,29 @@ uint32_t NOINLINE find_image(void) {
 		flashsize = 0x100000;
 	} else if (flag == 3 || flag == 5) {
 		ets_printf("16 Mbit\r\n");
-#ifdef BOOT_BIG_FLASH
 		flashsize = 0x200000;
-#else
-		flashsize = 0x100000; // limit to 8Mbit
-#endif
 	} else if (flag == 4 || flag == 6) {
 		ets_printf("32 Mbit\r\n");
-#ifdef BOOT_BIG_FLASH
 		flashsize = 0x400000;
-#else
-		flashsize = 0x100000; // limit to 8Mbit
-#endif
 	} else if (flag == 8) {
 		ets_printf("64 Mbit\r\n");
-#ifdef BOOT_BIG_FLASH
 		flashsize = 0x800000;
-#else
-		flashsize = 0x100000; // limit to 8Mbit
-#endif
 	} else if (flag == 9) {
 		ets_printf("128 Mbit\r\n");
-#ifdef BOOT_BIG_FLASH
 		flashsize = 0x1000000;
-#else
-		flashsize = 0x100000; // limit to 8Mbit
-#endif
 	} else {
 		ets_printf("unknown\r\n");
 		// assume at least 4mbit
 		flashsize = 0x80000;
 	}
+#ifdef BOOT_RECOVERY
+	// recovery can stage a rom anywhere on the chip
+	chipsize = flashsize;
+#endif
+#ifndef BOOT_BIG_FLASH
+	// limit to 8Mbit
+	if (flashsize > 0x100000) flashsize = 0x100000;
+#endif
 
 	// print spi mode
 	ets_printf("Flash Mode:   ");
@@ -398,6 +812,24 @@ uint32_t NOINLINE find_image(void) {
 #endif
 #ifdef BOOT_IROM_CHKSUM
 	ets_printf("rBoot Option: irom chksum\r\n");
+#endif
+#ifdef BOOT_CHKSUM_MAPPED
+	ets_printf("rBoot Option: Mapped chksum\r\n");
+#endif
+#ifdef BOOT_SIGNATURE
+	ets_printf("rBoot Option: Signed roms\r\n");
+#endif
+#ifdef BOOT_HIBERNATE
+	ets_printf("rBoot Option: Hibernate\r\n");
+#endif
+#ifdef BOOT_INSTALLER
+	ets_printf("rBoot Option: Installer\r\n");
+#endif
+#ifdef BOOT_RESET_ROUTING
+	ets_printf("rBoot Option: Reset reason routing\r\n");
+#endif
+#ifdef BOOT_RECOVERY
+	ets_printf("rBoot Option: Recovery (%d baud)\r\n", BOOT_RECOVERY_BAUD);
 #endif
 	ets_printf("\r\n");
 
@@ -423,6 +855,36 @@ uint32_t NOINLINE find_image(void) {
 		SPIWrite(BOOT_CONFIG_SECTOR * SECTOR_SIZE, buffer, SECTOR_SIZE);
 	}
 
+#ifdef BOOT_INSTALLER
+	// install any staged update before choosing a rom, it is
+	// checked like any other rom when we try to boot it below
+	if (romconf->install.pending == RBOOT_INSTALL_PENDING) {
+		if (romconf->install.rom < romconf->count) {
+			ets_printf("Installing update to rom %d.\r\n", romconf->install.rom);
+			if (!install_rom(&romconf->install, romconf->roms[romconf->install.rom])) {
+				ets_printf("Install failed.\r\n");
+			}
+		}
+		// only clear the record once the install has finished, if
+		// power is lost before now it will all be done again
+		romconf->install.pending = 0;
+#ifdef BOOT_CONFIG_CHKSUM
+		romconf->chksum = calc_chksum((uint8_t*)romconf, (uint8_t*)&romconf->chksum);
+#endif
+		SPIEraseSector(BOOT_CONFIG_SECTOR);
+		SPIWrite(BOOT_CONFIG_SECTOR * SECTOR_SIZE, buffer, SECTOR_SIZE);
+	}
+#endif
+
+#ifdef BOOT_RECOVERY_GPIO
+	// pin low == wait for a new rom over the uart first
+	if (BOOT_RECOVERY_GPIO == 16 ? (get_gpio16() == 0) : (get_gpio(BOOT_RECOVERY_GPIO) == 0)) {
+		if (recovery(romconf, chipsize, romconf->current_rom, BOOT_RECOVERY_TIMEOUT * 10) >= 0) {
+			updateConfig = 1;
+		}
+	}
+#endif
+
 	// try rom selected in the config, unless overriden by gpio/temp boot
 	romToBoot = romconf->current_rom;
 
@@ -480,8 +942,37 @@ uint32_t NOINLINE find_image(void) {
 		updateConfig = 1;
 	}
 
+#ifdef BOOT_RESET_ROUTING
+	// choose a rom by reset reason, unless overriden by gpio/temp boot,
+	// this doesn't change the current rom in the config
+	reason = get_reset_reason();
+	if ((romconf->mode & MODE_REASON_ROM) && reason < RBOOT_REASON_COUNT &&
+		romconf->reason_rom[reason] < romconf->count
+#ifdef BOOT_RTC_ENABLED
+		&& !temp_boot
+#endif
+#ifdef BOOT_GPIO_ENABLED
+		&& !gpio_boot
+#endif
+		) {
+		ets_printf("Booting rom for reset reason %d.\r\n", reason);
+		romToBoot = romconf->reason_rom[reason];
+		routed = 1;
+	}
+#endif
+
 	// check rom is valid
-	loadAddr = check_image(romconf->roms[romToBoot]);
+	loadAddr = check_rom(romconf, romToBoot);
+
+#ifdef BOOT_RESET_ROUTING
+	if (routed && loadAddr == 0) {
+		// fall back to the normal rom selection
+		ets_printf("Reset reason rom (%d) is bad.\r\n", romToBoot);
+		routed = 0;
+		romToBoot = romconf->current_rom;
+		loadAddr = check_rom(romconf, romToBoot);
+	}
+#endif
 
 #ifdef BOOT_GPIO_ENABLED
 	if (gpio_boot && loadAddr == 0) {
@@ -513,13 +1004,21 @@ uint32_t NOINLINE find_image(void) {
 		if (romToBoot == romconf->current_rom) {
 			// tried them all and all are bad!
 			ets_printf("No good rom available.\r\n");
+#ifdef BOOT_RECOVERY
+			romToBoot = recovery(romconf, chipsize, -1, RECOVERY_FOREVER);
+			if (romToBoot < 0) return 0;
+#else
 			return 0;
+#endif
 		}
-		loadAddr = check_image(romconf->roms[romToBoot]);
+		loadAddr = check_rom(romconf, romToBoot);
 	}
 
 	// re-write config, if required
 	if (updateConfig) {
+#ifdef BOOT_RESET_ROUTING
+		if (!routed)
+#endif
 		romconf->current_rom = romToBoot;
 #ifdef BOOT_CONFIG_CHKSUM
 		romconf->chksum = calc_chksum((uint8_t*)romconf, (uint8_t*)&romconf->chksum);
@@ -528,12 +1027,44 @@ uint32_t NOINLINE find_image(void) {
 		SPIWrite(BOOT_CONFIG_SECTOR * SECTOR_SIZE, buffer, SECTOR_SIZE);
 	}
 
+#ifdef BOOT_HIBERNATE
+	if (system_rtc_mem(RBOOT_HIBERNATE_RTC_ADDR, &hib, sizeof(rboot_hibernate_data), RBOOT_RTC_READ) &&
+		hib.magic == RBOOT_HIBERNATE_MAGIC && hib.chksum == calc_chksum((uint8_t*)&hib, (uint8_t*)&hib.chksum)) {
+		// only resume straight after deep sleep, in place of the
+		// rom the snapshot came from, and not for temp/gpio boots
+		if (get_reset_reason() == REASON_DEEP_SLEEP_AWAKE && hib.rom == romToBoot && !temp_boot
+#ifdef BOOT_GPIO_ENABLED
+			&& !gpio_boot
+#endif
+			) {
+			resumed = 1;
+		}
+		// check the snapshot is intact
+		if (resumed && (hib.addr = check_image(hib.addr)) != 0) {
+			ets_printf("Resuming snapshot of rom %d.\r\n", romToBoot);
+			loadAddr = hib.addr;
+		} else {
+			resumed = 0;
+		}
+		// one use only, the app saves a new one before each sleep
+		hib.magic = 0;
+		system_rtc_mem(RBOOT_HIBERNATE_RTC_ADDR, &hib, sizeof(rboot_hibernate_data), RBOOT_RTC_WRITE);
+	}
+#endif
+
 #ifdef BOOT_RTC_ENABLED
 	// set rtc boot data for app to read
 	rtc.magic = RBOOT_RTC_MAGIC;
 	rtc.next_mode = MODE_STANDARD;
 	rtc.last_mode = MODE_STANDARD;
 	if (temp_boot) rtc.last_mode |= MODE_TEMP_ROM;
+#ifdef BOOT_HIBERNATE
+	if (resumed) rtc.last_mode |= MODE_RESUMED;
+#endif
+#ifdef BOOT_RESET_ROUTING
+	if (routed) rtc.last_mode |= MODE_REASON_ROM;
+	rtc.last_reason = reason;
+#endif
 #ifdef BOOT_GPIO_ENABLED
 	if (gpio_boot) rtc.last_mode |= MODE_GPIO_ROM;
 #endif
@@ -544,8 +1075,22 @@ uint32_t NOINLINE find_image(void) {
 #endif
 
 	ets_printf("Booting rom %d at %x, load addr %x.\r\n", romToBoot, romconf->roms[romToBoot], loadAddr);
+#ifdef BOOT_STAGE2A_RELOCATE
+	// copy the loader to a free part of iram
+	stage2aAddr = place_stage2a(loadAddr);
+	if (stage2aAddr == 0) {
+		ets_printf("No room in iram for stage2a.\r\n");
+		return 0;
+	}
+	if (stage2aAddr != _text_addr) {
+		ets_printf("Stage2a moved to %x.\r\n", stage2aAddr);
+	}
+	ets_memcpy((void*)stage2aAddr, _text_data, _text_len);
+	stage2a_entry = stage2aAddr + (entry_addr - _text_addr);
+#else
 	// copy the loader to top of iram
 	ets_memcpy((void*)_text_addr, _text_data, _text_len);
+#endif
 	// return address to load from
 	return loadAddr;
 
@@ -560,7 +1105,11 @@ void call_user_start(void) {
 
 	addr = find_image();
 	if (addr != 0) {
+#ifdef BOOT_STAGE2A_RELOCATE
+		loader = (stage2a*)stage2a_entry;
+#else
 		loader = (stage2a*)entry_addr;
+#endif
 		loader(addr);
 	}
 }
@@ -577,7 +1126,11 @@ void call_user_start(void) {
 		"bnez a2, 1f\n"          // ?success
 		"ret\n"                  // no, return
 		"1:\n"                   // yes...
+#ifdef BOOT_STAGE2A_RELOCATE
+		"movi a3, stage2a_entry\n" // get pointer to stage2a_entry
+#else
 		"movi a3, entry_addr\n"  // get pointer to entry_addr
+#endif
 		"l32i a3, a3, 0\n"       // get value of entry_addr
 		"jx a3\n"                // now jump to it
 	);
@@ -22,6 +22,11 @@ extern "C" {
 // if you aren't using gcc you may need to do this
 //#define BOOT_NO_ASM
 
+// uncomment to place stage2a in any part of iram the rom being booted
+// doesn't load to, rather than at a fixed address at the top of iram,
+// which the rom then can't use
+//#define BOOT_STAGE2A_RELOCATE
+
 // uncomment to have a checksum on the boot config
 //#define BOOT_CONFIG_CHKSUM
 
@@ -32,6 +37,17 @@ extern "C" {
 // rBoot and the user app via the esp rtc data area
 //#define BOOT_RTC_ENABLED
 
+// uncomment to let the app save a snapshot of itself before deep
+// sleep (see rboot_hibernate_save in the api), which rBoot will then
+// resume on wake instead of booting the rom, needs BOOT_RTC_ENABLED
+//#define BOOT_HIBERNATE
+
+// uncomment to allow a rom to be chosen by reset reason, e.g. a
+// small image for deep sleep wakes and the full app otherwise (see
+// rboot_set_reason_rom in the api), with big flash this needs
+// BOOT_RTC_ENABLED so the app side maps the rom actually booted
+//#define BOOT_RESET_ROUTING
+
 // uncomment to enable GPIO booting of specific rom
 // (specified in rBoot config block)
 // cannot be used at same time as BOOT_GPIO_SKIP_ENABLED
@@ -51,6 +67,76 @@ extern "C" {
 // roms must be built with esptool2 using -iromchksum option
 //#define BOOT_IROM_CHKSUM
 
+// uncomment to read rom sections through the flash cache mapping
+// when checksumming them, with 32 bit loads instead of SPIRead
+// calls into a buffer (much quicker with BOOT_IROM_CHKSUM)
+//#define BOOT_CHKSUM_MAPPED
+
+// uncomment to only boot roms that have been verified by the
+// user app (see rboot_verify_rom in the api), the app checks the
+// image signature once after an update and records an attestation
+// in the boot config, so rBoot does no crypto at boot time
+//#define BOOT_SIGNATURE
+
+// uncomment to let rBoot install a compressed or delta encoded
+// update, staged anywhere on the flash by the app, into a rom slot
+// on the next boot (see rboot_set_install in the api)
+//#define BOOT_INSTALLER
+
+// uncomment to let rBoot take a new rom over the uart, at a high baud
+// rate, when no rom is good (or at boot with BOOT_RECOVERY_GPIO held
+// low), sent as an install payload by rboot-recover, needs BOOT_INSTALLER
+//#define BOOT_RECOVERY
+
+// gpio to hold low at boot to enter recovery (optional), the baud rate
+// used (defaults to 921600) and how long (in ms) to wait for the sender
+// after a gpio entry before booting normally (defaults to 5000)
+//#define BOOT_RECOVERY_GPIO 0
+//#define BOOT_RECOVERY_BAUD 921600
+//#define BOOT_RECOVERY_TIMEOUT 5000
+
+// uncomment to have the api record a SHA-256 digest of each rom
+// written through it in the boot config, so the app can check if an
+// image it has been asked to install is already on the flash
+//#define BOOT_ROM_DIGEST
+
+// uncomment to let the api write a bundle of several images (made
+// with rboot-bundle) to their slots from a single stream
+//#define BOOT_BUNDLE
+
+// uncomment to let the api erase large aligned areas with 64KB
+// block erases (used by rboot_erase_flash and rboot_write_erase),
+// much faster per byte than erasing one 4KB sector at a time
+//#define BOOT_BLOCK_ERASE
+
+// uncomment to have the api keep statistics on ota writes (time
+// spent erasing and programming, call latency, heap use), see
+// rboot_write_get_stats
+//#define BOOT_OTA_STATS
+
+// uncomment to let the api run an ota write as a pipeline, the network
+// side copies into a ring buffer and a separate writer task does the
+// flash writes (see rboot_pipe_push)
+//#define BOOT_OTA_PIPE
+
+// uncomment to let the api keep a small lru cache of flash pages in
+// ram for reads of data from flash (see rboot_cache_read), so repeated
+// small reads of the same data don't each need a flash read
+//#define BOOT_READ_CACHE
+
+// uncomment to let a big flash app read data from any 1MB segment of
+// the flash through the memory mapping (see rboot_mmap_read), rather
+// than only the segment its code runs from, needs BOOT_BIG_FLASH
+//#define BOOT_MMAP_READ
+
+// uncomment to let the api load sections of overlay images into a
+// reserved iram window at runtime (see RBOOT_OVERLAY_ADDR)
+//#define BOOT_OVERLAY
+
+// uncomment to let the api scrub roms against a per sector crc
+// manifest (added by rboot-pack -manifest) and repair bad sectors
+//#define BOOT_MANIFEST
+
 // uncomment to add a boot delay, allows you time to connect
 // a terminal before rBoot starts to run and output messages
 // value is in microseconds
@@ -80,17 +166,31 @@ extern "C" {
 #define BOOT_CONFIG_MAGIC 0xe1
 #define BOOT_CONFIG_VERSION 0x01
 
+#define RBOOT_DIGEST_LEN 32
+
+// reset reasons that can be routed (sdk rst_reason values 0-6)
+#define RBOOT_REASON_COUNT 8
+#define RBOOT_NO_ROUTE 0xff
+
+#define RBOOT_INSTALL_PENDING 0xa5
+
 #define MODE_STANDARD    0x00
 #define MODE_GPIO_ROM    0x01
 #define MODE_TEMP_ROM    0x02
 #define MODE_GPIO_ERASES_SDKCONFIG 0x04
 #define MODE_GPIO_SKIP   0x08
+#define MODE_RESUMED     0x10
+#define MODE_REASON_ROM  0x20
 
 #define RBOOT_RTC_MAGIC 0x2334ae68
 #define RBOOT_RTC_READ 1
 #define RBOOT_RTC_WRITE 0
 #define RBOOT_RTC_ADDR 64
 
+#define RBOOT_HIBERNATE_MAGIC 0x4e524248
+// in 4 byte blocks, straight after rboot_rtc_data
+#define RBOOT_HIBERNATE_RTC_ADDR (RBOOT_RTC_ADDR + ((sizeof(rboot_rtc_data) + 3) / 4))
+
 // defaults for unset user options
 #ifndef BOOT_GPIO_NUM
 #define BOOT_GPIO_NUM 16
@@ -100,6 +200,61 @@ extern "C" {
 #define MAX_ROMS 4
 #endif
 
+#ifndef BOOT_RECOVERY_BAUD
+#define BOOT_RECOVERY_BAUD 921600
+#endif
+#ifndef BOOT_RECOVERY_TIMEOUT
+#define BOOT_RECOVERY_TIMEOUT 5000
+#endif
+
+#if defined(BOOT_HIBERNATE) && !defined(BOOT_RTC_ENABLED)
+#error "BOOT_HIBERNATE needs BOOT_RTC_ENABLED"
+#endif
+#if defined(BOOT_RESET_ROUTING) && defined(BOOT_BIG_FLASH) && !defined(BOOT_RTC_ENABLED)
+#error "BOOT_RESET_ROUTING with BOOT_BIG_FLASH needs BOOT_RTC_ENABLED"
+#endif
+#if defined(BOOT_MMAP_READ) && !defined(BOOT_BIG_FLASH)
+#error "BOOT_MMAP_READ needs BOOT_BIG_FLASH"
+#endif
+#if defined(BOOT_RECOVERY) && !defined(BOOT_INSTALLER)
+#error "BOOT_RECOVERY needs BOOT_INSTALLER"
+#endif
+#if defined(BOOT_RECOVERY_GPIO) && !defined(BOOT_RECOVERY)
+#error "BOOT_RECOVERY_GPIO needs BOOT_RECOVERY"
+#endif
+#if defined(BOOT_HIBERNATE) && defined(BOOT_SIGNATURE)
+#error "BOOT_HIBERNATE can't be used with BOOT_SIGNATURE, snapshots are not signed"
+#endif
+#if defined(BOOT_INSTALLER) && defined(BOOT_SIGNATURE)
+#error "BOOT_INSTALLER can't be used with BOOT_SIGNATURE, the app can't attest a rom before it is installed"
+#endif
+
+#ifdef BOOT_SIGNATURE
+/** @brief  Record of a successful signature check of a ROM by the user app
+ *  @note   Only valid while generation matches the ROM's current write
+ *          generation in the config, rewriting the ROM invalidates it.
+ *  @ingroup rboot
+*/
+typedef struct {
+	uint8_t rom;             ///< ROM slot the attestation applies to
+	uint8_t generation;      ///< Write generation of the ROM when it was verified
+	uint8_t digest[6];       ///< Leading bytes of the verified SHA-256 digest of the ROM
+} rboot_attestation;
+#endif
+
+#ifdef BOOT_INSTALLER
+/** @brief  Record of an update waiting to be installed by rBoot
+ *  @ingroup rboot
+*/
+typedef struct {
+	uint32_t addr;           ///< Flash address of the install payload
+	uint32_t len;            ///< Length of the install payload
+	uint8_t rom;             ///< ROM slot to install to
+	uint8_t pending;         ///< RBOOT_INSTALL_PENDING if there is an install to do
+	uint8_t unused[2];       ///< Padding (not used)
+} rboot_install;
+#endif
+
 /** @brief  Structure containing rBoot configuration
  *  @note   ROM addresses must be multiples of 0x1000 (flash sector aligned).
  *          Without BOOT_BIG_FLASH only the first 8Mbit (1MB) of the chip will
@@ -113,12 +268,25 @@ extern "C" {
 typedef struct {
 	uint8_t magic;           ///< Our magic, identifies rBoot configuration - should be BOOT_CONFIG_MAGIC
 	uint8_t version;         ///< Version of configuration structure - should be BOOT_CONFIG_VERSION
-	uint8_t mode;            ///< Boot loader mode (MODE_STANDARD | MODE_GPIO_ROM | MODE_GPIO_SKIP)
+	uint8_t mode;            ///< Boot loader mode (MODE_STANDARD | MODE_GPIO_ROM | MODE_GPIO_SKIP | MODE_REASON_ROM)
 	uint8_t current_rom;     ///< Currently selected ROM (will be used for next standard boot)
 	uint8_t gpio_rom;        ///< ROM to use for GPIO boot (hardware switch) with mode set to MODE_GPIO_ROM
 	uint8_t count;           ///< Quantity of ROMs available to boot
 	uint8_t unused[2];       ///< Padding (not used)
 	uint32_t roms[MAX_ROMS]; ///< Flash addresses of each ROM
+#ifdef BOOT_SIGNATURE
+	uint8_t generation[MAX_ROMS];       ///< Write generation of each ROM, 0 for factory installed ROMs
+	rboot_attestation attest[MAX_ROMS]; ///< Signature attestation for each ROM (if BOOT_SIGNATURE defined)
+#endif
+#ifdef BOOT_ROM_DIGEST
+	uint8_t digest[MAX_ROMS][RBOOT_DIGEST_LEN]; ///< SHA-256 of each ROM as written by the API, zero if unknown
+#endif
+#ifdef BOOT_INSTALLER
+	rboot_install install;   ///< Update for rBoot to install on next boot (if BOOT_INSTALLER defined)
+#endif
+#ifdef BOOT_RESET_ROUTING
+	uint8_t reason_rom[RBOOT_REASON_COUNT]; ///< ROM to boot for each reset reason, or RBOOT_NO_ROUTE, with mode set to MODE_REASON_ROM
+#endif
 #ifdef BOOT_CONFIG_CHKSUM
 	uint8_t chksum;          ///< Checksum of this configuration structure (if BOOT_CONFIG_CHKSUM defined)
 #endif
@@ -136,8 +304,27 @@ typedef struct {
 	uint8_t last_mode;        ///< The last (this) boot mode - can be MODE_STANDARD, MODE_GPIO_ROM or MODE_TEMP_ROM
 	uint8_t last_rom;         ///< The last (this) boot rom number
 	uint8_t temp_rom;         ///< The next boot rom number when next_mode set to MODE_TEMP_ROM
+#ifdef BOOT_RESET_ROUTING
+	uint8_t last_reason;      ///< The reset reason for the last (this) boot, last_mode includes MODE_REASON_ROM if it chose the rom
+#endif
 	uint8_t chksum;           ///< Checksum of this structure this will be updated for you passed to the API
 } rboot_rtc_data;
+
+#ifdef BOOT_HIBERNATE
+/** @brief  Record of a hibernate snapshot, in the ESP RTC data area
+ *  @note   Set by the API when a snapshot is saved. Cleared by rBoot on the
+ *          next boot, whether or not the snapshot is resumed, so each
+ *          snapshot is only used once.
+ *  @ingroup rboot
+*/
+typedef struct {
+	uint32_t magic;           ///< Magic, should be RBOOT_HIBERNATE_MAGIC
+	uint32_t addr;            ///< Flash address of the snapshot
+	uint8_t rom;              ///< ROM the snapshot was taken from, it will only be resumed in place of this ROM
+	uint8_t unused[2];        ///< Padding (not used)
+	uint8_t chksum;           ///< Checksum of this structure
+} rboot_hibernate_data;
+#endif
 #endif
 
 // override function to create default config, must be placed after type
@@ -0,0 +1,177 @@
+//////////////////////////////////////////////////
+// rBoot boot simulator, runs on the host.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Runs the real rBoot find_image and stage2a load_rom, built with the
+// same options as the bootloader, against the emulated flash holding a
+// typical rom. Reports the simulated flash time for a first boot (which
+// writes the default config) and a normal boot, and for loading the rom.
+// Only flash time is modelled, not cpu time. Used by the option matrix
+// (make matrix), but can be run by hand. Needs a 64 bit Linux host (see
+// bootsim.h).
+//
+// With BOOT_RECOVERY, -recover <file> starts with an empty flash, saves
+// the rom to the file and gives rBoot a pty as its uart, for rboot-recover
+// to send the rom over.
+
+#ifdef BOOT_RECOVERY
+// for posix_openpt
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#endif
+#include <stdio.h>
+
+#include "bootsim.h"
+
+#define FLASH_SIZE   0x400000
+#define ROM_ADDR     0x002000
+
+static int boot(const char *name, uint32_t *addr) {
+	uint64_t start = flashsim_dev->clock_ns;
+	uint32_t reads = flashsim_dev->stats.reads;
+	uint64_t bytes = flashsim_dev->stats.read_bytes;
+	*addr = find_image();
+	printf("%-6s %9.2f ms %6u reads %8.1f KB\n", name, (flashsim_dev->clock_ns - start) / 1e6,
+		flashsim_dev->stats.reads - reads, (flashsim_dev->stats.read_bytes - bytes) / 1024.0);
+	return (*addr != 0);
+}
+
+#ifdef BOOT_RECOVERY
+static int uart_slave = -1;
+
+// a pty for rBoot's uart, raw both ends, the slave is held open so
+// the master doesn't see a hangup between senders
+static int open_uart(void) {
+	struct termios tio;
+	int slave;
+
+	bootsim_uart = posix_openpt(O_RDWR | O_NOCTTY);
+	if (bootsim_uart < 0 || grantpt(bootsim_uart) != 0 || unlockpt(bootsim_uart) != 0 ||
+		(slave = open(ptsname(bootsim_uart), O_RDWR | O_NOCTTY)) < 0 ||
+		tcgetattr(slave, &tio) != 0) {
+		return 0;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+	uart_slave = slave;
+	printf("uart   %s\n", ptsname(bootsim_uart));
+	fflush(stdout);
+	return 1;
+}
+
+// closing the master throws away anything not yet read from the slave,
+// so wait for the sender to read the last reply, then for it to close
+// the port (or give up after a few seconds each)
+static void close_uart(void) {
+	struct pollfd pfd;
+	int waiting;
+	int loop;
+
+	for (loop = 0; loop < 500; loop++) {
+		if (ioctl(uart_slave, FIONREAD, &waiting) != 0 || waiting == 0) break;
+		usleep(10000);
+	}
+	close(uart_slave);
+	pfd.fd = bootsim_uart;
+	pfd.events = 0;
+	for (loop = 0; loop < 50; loop++) {
+		if (poll(&pfd, 1, 100) > 0 && (pfd.revents & POLLHUP)) break;
+	}
+	close(bootsim_uart);
+	bootsim_uart = -1;
+}
+#endif
+
+static void usage(void) {
+	printf("Usage: boot-sim [-i irom_size] [-r iram_size] [-v]");
+#ifdef BOOT_RECOVERY
+	printf(" [-recover rom_file]");
+#endif
+	printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t irom_len = 300 * 1024;
+	uint32_t iram_len = 0x6000;
+	uint32_t addr;
+	uint32_t len;
+	uint8_t *rom;
+	uint64_t start;
+	char *recover = NULL;
+	usercode *entry;
+	int ok;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-i") && i + 1 < argc) irom_len = strtoul(argv[++i], NULL, 0) & ~3;
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc) iram_len = strtoul(argv[++i], NULL, 0) & ~3;
+		else if (!strcmp(argv[i], "-v")) flashsim_verbose = 1;
+#ifdef BOOT_RECOVERY
+		else if (!strcmp(argv[i], "-recover") && i + 1 < argc) recover = argv[++i];
+#endif
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (irom_len > 0xf0000 || iram_len > 0xfc00 - 0x10) {
+		fprintf(stderr, "Invalid rom size.\n");
+		return 1;
+	}
+
+	if (!bootsim_map()) {
+		fprintf(stderr, "Can't map esp8266 address space.\n");
+		return 1;
+	}
+
+	if (!flashsim_create(FLASH_SIZE)) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	srand(1);
+	rom = malloc(irom_len + iram_len + 0x1000);
+	len = bootsim_make_rom(rom, irom_len, iram_len);
+	// rBoot itself, only the header (flash size) is read
+	flashsim_load(0, rom, 8);
+	if (recover) {
+#ifdef BOOT_RECOVERY
+		// no rom on the flash, it comes over the uart
+		FILE *f = fopen(recover, "wb");
+		if (!f || fwrite(rom, 1, len, f) != len || fclose(f) != 0) {
+			fprintf(stderr, "Can't write rom file '%s'.\n", recover);
+			return 1;
+		}
+		if (!open_uart()) {
+			fprintf(stderr, "Can't open pty.\n");
+			return 1;
+		}
+#endif
+	} else {
+		flashsim_load(ROM_ADDR, rom, len);
+	}
+
+	printf("rBoot boot simulation, rom %u bytes\n", len);
+	ok = boot("first", &addr) && boot("normal", &addr);
+#ifdef BOOT_RECOVERY
+	if (bootsim_uart >= 0) close_uart();
+#endif
+	if (!ok) {
+		printf("boot failed\n");
+		return 1;
+	}
+	start = flashsim_dev->clock_ns;
+	entry = load_rom(addr);
+	printf("%-6s %9.2f ms\n", "load", (flashsim_dev->clock_ns - start) / 1e6);
+	if ((uint32_t)(uintptr_t)entry != BOOTSIM_ROM_ENTRY ||
+		memcmp((void*)BOOTSIM_IRAM_ADDR, rom + BOOTSIM_IRAM_OFFSET(irom_len), iram_len)) {
+		printf("rom not loaded correctly\n");
+		return 1;
+	}
+	free(rom);
+	return 0;
+}
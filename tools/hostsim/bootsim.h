@@ -0,0 +1,158 @@
+#ifndef __BOOTSIM_H__
+#define __BOOTSIM_H__
+
+//////////////////////////////////////////////////
+// rBoot bootloader on the host.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Builds the real rBoot find_image and stage2a load_rom into a host program
+// (include from just one source file), on top of the flash emulator, and
+// makes typical roms for it to boot. rBoot's ram and peripheral addresses
+// are mapped on the host, so this needs a 64 bit Linux host where they are
+// free. Used by boot-sim and fleet-sim.
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "flashsim.h"
+
+#ifdef BOOT_CHKSUM_MAPPED
+#error "The flash cache isn't emulated, build without BOOT_CHKSUM_MAPPED"
+#endif
+
+#ifdef BOOT_STAGE2A_RELOCATE
+// rBoot's own code is in the first part of iram
+static uint32_t *sim_text_end = (uint32_t*)0x40101000;
+#define _text_end (*sim_text_end)
+#endif
+
+// host builds always use the c stubs
+#ifndef BOOT_NO_ASM
+#define BOOT_NO_ASM
+#endif
+
+#ifdef BOOT_RECOVERY
+#include <poll.h>
+#include <unistd.h>
+
+// rBoot's uart for recovery is a file descriptor (e.g. a pty) on the host
+static int bootsim_uart = -1;
+
+static int bootsim_uart_count(void) {
+	struct pollfd pfd = { bootsim_uart, POLLIN, 0 };
+	return (bootsim_uart >= 0 && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) ? 1 : 0;
+}
+
+static uint8_t bootsim_uart_rx(void) {
+	uint8_t c = 0;
+	return (read(bootsim_uart, &c, 1) == 1) ? c : 0;
+}
+
+static void bootsim_uart_tx(uint8_t c) {
+	if (write(bootsim_uart, &c, 1) != 1) {
+		// no reply, the sender will retry
+	}
+}
+
+#define RECOVERY_RX_COUNT() bootsim_uart_count()
+#define RECOVERY_RX() bootsim_uart_rx()
+#define RECOVERY_TX(c) bootsim_uart_tx(c)
+#define RECOVERY_FLUSH()
+#define RECOVERY_TICK() usleep(100)
+// without a uart don't wait for an image
+#define RECOVERY_FOREVER ((bootsim_uart < 0) ? 1 : 0)
+#endif
+
+#include "../../rboot.c"
+#define call_user_start stage2a_call_user_start
+#include "../../rboot-stage2a.c"
+#undef call_user_start
+
+#define BOOTSIM_ROM_ENTRY   0x40100004
+#define BOOTSIM_PERIPH_ADDR 0x60000000
+#define BOOTSIM_PERIPH_SIZE 0x2000
+#define BOOTSIM_RTC_ADDR    0x60001100
+#define BOOTSIM_RAM_ADDR    0x3ffe8000
+#define BOOTSIM_RAM_SIZE    (0x40110000 - BOOTSIM_RAM_ADDR)
+#define BOOTSIM_IRAM_ADDR   0x40100000
+
+void uart_div_modify(uint8_t uart, uint32_t div) {
+}
+
+// map the esp8266 address space, peripherals read as all ones: gpio
+// not pressed, no rtc data
+static int bootsim_map(void) {
+	if (mmap((void*)BOOTSIM_PERIPH_ADDR, BOOTSIM_PERIPH_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED ||
+		mmap((void*)BOOTSIM_RAM_ADDR, BOOTSIM_RAM_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+		return 0;
+	}
+	memset((void*)BOOTSIM_PERIPH_ADDR, 0xff, BOOTSIM_PERIPH_SIZE);
+	return 1;
+}
+
+static void bootsim_put_le32(uint8_t *p, uint32_t val) {
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+}
+
+// a new type (esptool2 -boot2) rom, with an irom section, one iram
+// section and two dram sections, filled with random data (from rand)
+// rom must have room for irom_len + iram_len + 0x1000
+static uint32_t bootsim_make_rom(uint8_t *rom, uint32_t irom_len, uint32_t iram_len) {
+	static const uint32_t dram_len[2] = { 0x400, 0x1800 };
+	uint32_t pos = 0;
+	uint32_t loop;
+	uint8_t chksum = CHKSUM_INIT;
+
+	rom[pos++] = ROM_MAGIC_NEW1;
+	rom[pos++] = ROM_MAGIC_NEW2;
+	rom[pos++] = 0x00;
+	rom[pos++] = 0x40;
+	bootsim_put_le32(rom + pos, BOOTSIM_ROM_ENTRY);
+	bootsim_put_le32(rom + pos + 4, 0);
+	bootsim_put_le32(rom + pos + 8, irom_len);
+	pos += 12;
+	for (loop = 0; loop < irom_len; loop++) {
+		rom[pos + loop] = rand();
+#ifdef BOOT_IROM_CHKSUM
+		chksum ^= rom[pos + loop];
+#endif
+	}
+	pos += irom_len;
+
+	rom[pos++] = ROM_MAGIC;
+	rom[pos++] = 3;
+	rom[pos++] = 0x00;
+	rom[pos++] = 0x40;
+	bootsim_put_le32(rom + pos, BOOTSIM_ROM_ENTRY);
+	pos += 4;
+	for (loop = 0; loop < 3; loop++) {
+		uint32_t addr = (loop == 0) ? BOOTSIM_IRAM_ADDR : (loop == 1) ? BOOTSIM_RAM_ADDR : BOOTSIM_RAM_ADDR + 0x400;
+		uint32_t len = (loop == 0) ? iram_len : dram_len[loop - 1];
+		uint32_t i;
+		bootsim_put_le32(rom + pos, addr);
+		bootsim_put_le32(rom + pos + 4, len);
+		pos += 8;
+		for (i = 0; i < len; i++) {
+			rom[pos + i] = rand();
+			chksum ^= rom[pos + i];
+		}
+		pos += len;
+	}
+	pos |= 0x0f;
+	rom[pos++] = chksum;
+	return pos;
+}
+
+// offset of the iram section's data in a rom from bootsim_make_rom
+#define BOOTSIM_IRAM_OFFSET(irom_len) ((irom_len) + 32)
+
+#endif
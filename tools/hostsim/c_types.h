@@ -0,0 +1,35 @@
+#ifndef __C_TYPES_H__
+#define __C_TYPES_H__
+
+//////////////////////////////////////////////////
+// rBoot host flash emulator.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// host stand-in for the sdk c_types.h, also declares the other
+// sdk functions the rBoot api uses (see flashsim.c)
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t  uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef int8_t   sint8;
+typedef int16_t  sint16;
+typedef int32_t  sint32;
+
+#define ICACHE_FLASH_ATTR
+#define IRAM_ATTR
+
+void *pvPortMalloc(size_t size, const char *file, int line);
+void vPortFree(void *ptr, const char *file, int line);
+bool system_rtc_mem_read(uint8 src_addr, void *des_addr, uint16 load_size);
+bool system_rtc_mem_write(uint8 des_addr, const void *src_addr, uint16 save_size);
+uint32 system_get_time(void);
+uint32 system_get_free_heap_size(void);
+
+#endif
@@ -0,0 +1,304 @@
+//////////////////////////////////////////////////
+// rBoot host flash emulator.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <c_types.h>
+#include <spi_flash.h>
+
+#include "flashsim.h"
+
+flashsim_timing flashsim_time = {
+	10000,    // read call, sdk cache disable/enable and command
+	100,      // read byte, ~10MB/s
+	10000,    // program call
+	700000,   // page program, 0.7ms
+	100,      // program byte
+	45000000, // sector erase, 45ms
+	150000000 // block erase, 150ms
+};
+
+flashsim_device *flashsim_dev = NULL;
+int flashsim_verbose = 0;
+void (*flashsim_power_fail)(void) = NULL;
+
+static const uint8_t erased[FLASHSIM_SECTOR_SIZE] = { [0 ... FLASHSIM_SECTOR_SIZE - 1] = 0xff };
+
+flashsim_device *flashsim_create(uint32_t size) {
+	flashsim_device *dev;
+	uint32_t count = size / FLASHSIM_SECTOR_SIZE;
+
+	dev = calloc(1, sizeof(flashsim_device));
+	if (!dev) return NULL;
+	dev->size = size;
+	dev->sectors = calloc(count, sizeof(uint8_t*));
+	dev->erase_count = calloc(count, sizeof(uint32_t));
+	if (!dev->sectors || !dev->erase_count) {
+		flashsim_destroy(dev);
+		return NULL;
+	}
+	flashsim_dev = dev;
+	return dev;
+}
+
+void flashsim_destroy(flashsim_device *dev) {
+	uint32_t loop;
+	if (!dev) return;
+	if (dev->sectors) {
+		for (loop = 0; loop < dev->size / FLASHSIM_SECTOR_SIZE; loop++) {
+			free(dev->sectors[loop]);
+		}
+	}
+	free(dev->sectors);
+	free(dev->erase_count);
+	if (flashsim_dev == dev) flashsim_dev = NULL;
+	free(dev);
+}
+
+void flashsim_select(flashsim_device *dev) {
+	flashsim_dev = dev;
+}
+
+void flashsim_reset_stats(void) {
+	memset(&flashsim_dev->stats, 0, sizeof(flashsim_stats));
+	flashsim_dev->stats.heap_peak = flashsim_dev->heap_used;
+}
+
+void flashsim_delay_ns(uint64_t ns) {
+	flashsim_dev->clock_ns += ns;
+}
+
+static void erase_sector(uint32_t sector) {
+	free(flashsim_dev->sectors[sector]);
+	flashsim_dev->sectors[sector] = NULL;
+	flashsim_dev->erase_count[sector]++;
+}
+
+// nor flash program, bits can only be cleared
+static int program(uint32_t addr, const uint8_t *data, uint32_t len) {
+	int bad = 0;
+	while (len > 0) {
+		uint32_t sector = addr / FLASHSIM_SECTOR_SIZE;
+		uint32_t offset = addr % FLASHSIM_SECTOR_SIZE;
+		uint32_t take = FLASHSIM_SECTOR_SIZE - offset;
+		uint8_t *mem;
+		if (take > len) take = len;
+		if (!flashsim_dev->sectors[sector]) {
+			flashsim_dev->sectors[sector] = malloc(FLASHSIM_SECTOR_SIZE);
+			memset(flashsim_dev->sectors[sector], 0xff, FLASHSIM_SECTOR_SIZE);
+		}
+		mem = flashsim_dev->sectors[sector] + offset;
+		for (addr += take, len -= take; take > 0; take--, mem++, data++) {
+			if (*data & ~*mem) bad = 1;
+			*mem &= *data;
+		}
+	}
+	return bad;
+}
+
+void flashsim_load(uint32_t addr, const void *data, uint32_t len) {
+	uint32_t sector;
+	for (sector = addr / FLASHSIM_SECTOR_SIZE; sector * FLASHSIM_SECTOR_SIZE < addr + len; sector++) {
+		free(flashsim_dev->sectors[sector]);
+		flashsim_dev->sectors[sector] = NULL;
+	}
+	program(addr, data, len);
+}
+
+void flashsim_peek(uint32_t addr, void *data, uint32_t len) {
+	uint8_t *out = data;
+	while (len > 0) {
+		uint32_t sector = addr / FLASHSIM_SECTOR_SIZE;
+		uint32_t offset = addr % FLASHSIM_SECTOR_SIZE;
+		uint32_t take = FLASHSIM_SECTOR_SIZE - offset;
+		if (take > len) take = len;
+		memcpy(out, (flashsim_dev->sectors[sector] ? flashsim_dev->sectors[sector] : erased) + offset, take);
+		out += take;
+		addr += take;
+		len -= take;
+	}
+}
+
+// count down to a power cut, true if it is this operation
+static int power_cut(void) {
+	return (flashsim_dev->power_fail_ops && --flashsim_dev->power_fail_ops == 0 && flashsim_power_fail);
+}
+
+static int in_range(uint32_t addr, uint32_t len) {
+	return (addr < flashsim_dev->size && len <= flashsim_dev->size - addr);
+}
+
+static int do_read(uint32_t addr, void *data, uint32_t len) {
+	uint64_t ns = flashsim_time.read_call_ns + (uint64_t)len * flashsim_time.read_byte_ns;
+	if (!in_range(addr, len)) return 1;
+	flashsim_peek(addr, data, len);
+	flashsim_dev->stats.reads++;
+	flashsim_dev->stats.read_bytes += len;
+	flashsim_dev->stats.read_ns += ns;
+	flashsim_dev->clock_ns += ns;
+	return 0;
+}
+
+static int do_write(uint32_t addr, const void *data, uint32_t len) {
+	uint64_t ns;
+	uint32_t pages;
+	if (!in_range(addr, len)) return 1;
+	// each page touched is a separate program operation
+	pages = len ? ((addr + len - 1) / FLASHSIM_PAGE_SIZE) - (addr / FLASHSIM_PAGE_SIZE) + 1 : 0;
+	ns = flashsim_time.program_call_ns + (uint64_t)pages * flashsim_time.program_page_ns +
+		(uint64_t)len * flashsim_time.program_byte_ns;
+	if (power_cut()) {
+		program(addr, data, len / 2);
+		flashsim_power_fail();
+	}
+	if (program(addr, data, len)) {
+		flashsim_dev->stats.bad_writes++;
+		if (flashsim_verbose) fprintf(stderr, "flashsim: write to unerased flash at 0x%08x\n", addr);
+	}
+	flashsim_dev->stats.writes++;
+	flashsim_dev->stats.write_bytes += len;
+	flashsim_dev->stats.program_ns += ns;
+	flashsim_dev->clock_ns += ns;
+	return 0;
+}
+
+static int do_erase(uint32_t sector) {
+	if (sector >= flashsim_dev->size / FLASHSIM_SECTOR_SIZE) return 1;
+	erase_sector(sector);
+	if (power_cut()) flashsim_power_fail();
+	flashsim_dev->stats.sector_erases++;
+	flashsim_dev->stats.erase_ns += flashsim_time.erase_sector_ns;
+	flashsim_dev->clock_ns += flashsim_time.erase_sector_ns;
+	return 0;
+}
+
+static int do_erase_block(uint32_t block) {
+	uint32_t sector;
+	uint32_t count = FLASHSIM_BLOCK_SIZE / FLASHSIM_SECTOR_SIZE;
+	if ((block + 1) * count > flashsim_dev->size / FLASHSIM_SECTOR_SIZE) return 1;
+	for (sector = block * count; sector < (block + 1) * count; sector++) {
+		erase_sector(sector);
+	}
+	if (power_cut()) flashsim_power_fail();
+	flashsim_dev->stats.block_erases++;
+	flashsim_dev->stats.erase_ns += flashsim_time.erase_block_ns;
+	flashsim_dev->clock_ns += flashsim_time.erase_block_ns;
+	return 0;
+}
+
+//////////////////////////////////////////////////
+// sdk functions
+//////////////////////////////////////////////////
+
+SpiFlashOpResult spi_flash_read(uint32 src_addr, uint32 *des_addr, uint32 size) {
+	return do_read(src_addr, des_addr, size) ? SPI_FLASH_RESULT_ERR : SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_write(uint32 des_addr, uint32 *src_addr, uint32 size) {
+	// sdk requires word aligned address, buffer and length
+	if ((des_addr & 3) || ((uintptr_t)src_addr & 3) || (size & 3)) {
+		if (flashsim_verbose) fprintf(stderr, "flashsim: unaligned write at 0x%08x\n", des_addr);
+		return SPI_FLASH_RESULT_ERR;
+	}
+	return do_write(des_addr, src_addr, size) ? SPI_FLASH_RESULT_ERR : SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_erase_sector(uint16 sec) {
+	return do_erase(sec) ? SPI_FLASH_RESULT_ERR : SPI_FLASH_RESULT_OK;
+}
+
+// heap blocks carry their size, to track usage
+void *pvPortMalloc(size_t size, const char *file, int line) {
+	size_t *block = malloc(size + sizeof(size_t) * 2);
+	if (!block) return NULL;
+	block[0] = size;
+	flashsim_dev->heap_used += size;
+	flashsim_dev->stats.allocs++;
+	if (flashsim_dev->heap_used > flashsim_dev->stats.heap_peak) {
+		flashsim_dev->stats.heap_peak = flashsim_dev->heap_used;
+	}
+	return block + 2;
+}
+
+void vPortFree(void *ptr, const char *file, int line) {
+	size_t *block = ptr;
+	if (!ptr) return;
+	block -= 2;
+	flashsim_dev->heap_used -= block[0];
+	free(block);
+}
+
+// rtc memory is addressed in 4 byte blocks, user blocks start at 64
+bool system_rtc_mem_read(uint8 src_addr, void *des_addr, uint16 load_size) {
+	if (src_addr < 64 || ((uint32_t)src_addr * 4) + load_size > FLASHSIM_RTC_SIZE) return false;
+	memcpy(des_addr, flashsim_dev->rtc + (src_addr * 4), load_size);
+	return true;
+}
+
+bool system_rtc_mem_write(uint8 des_addr, const void *src_addr, uint16 save_size) {
+	if (des_addr < 64 || ((uint32_t)des_addr * 4) + save_size > FLASHSIM_RTC_SIZE) return false;
+	memcpy(flashsim_dev->rtc + (des_addr * 4), src_addr, save_size);
+	return true;
+}
+
+uint32 system_get_time(void) {
+	return (uint32)(flashsim_dev->clock_ns / 1000);
+}
+
+// free heap as seen by the app, assuming a typical amount left by the sdk
+uint32 system_get_free_heap_size(void) {
+	return (flashsim_dev->heap_used < FLASHSIM_HEAP_SIZE) ? FLASHSIM_HEAP_SIZE - flashsim_dev->heap_used : 0;
+}
+
+void Cache_Read_Disable_2(void) {
+}
+
+void Cache_Read_Enable_2(void) {
+}
+
+//////////////////////////////////////////////////
+// mask rom functions
+//////////////////////////////////////////////////
+
+uint32_t SPIRead(uint32_t addr, void *outptr, uint32_t len) {
+	return do_read(addr, outptr, len);
+}
+
+uint32_t SPIWrite(uint32_t addr, void *inptr, uint32_t len) {
+	return do_write(addr, inptr, len);
+}
+
+uint32_t SPIEraseSector(int sector) {
+	return do_erase(sector);
+}
+
+uint32_t SPIEraseBlock(uint32_t block) {
+	return do_erase_block(block);
+}
+
+void ets_printf(const char *fmt, ...) {
+	va_list args;
+	if (!flashsim_verbose) return;
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+void ets_delay_us(int us) {
+	flashsim_dev->clock_ns += (uint64_t)us * 1000;
+}
+
+void ets_memset(void *dst, uint8_t val, uint32_t len) {
+	memset(dst, val, len);
+}
+
+void ets_memcpy(void *dst, const void *src, uint32_t len) {
+	memcpy(dst, src, len);
+}
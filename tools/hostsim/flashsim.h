@@ -0,0 +1,93 @@
+#ifndef __FLASHSIM_H__
+#define __FLASHSIM_H__
+
+//////////////////////////////////////////////////
+// rBoot host flash emulator.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Emulates the SDK flash, heap and rtc memory functions used by the rBoot
+// api (and the rom functions used by rBoot itself), so they can be built and
+// run on the host. Flash behaves like nor flash (erase sets bits, program can
+// only clear them) and every operation advances a simulated clock according
+// to a simple timing model. Erase counts are kept per sector.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASHSIM_SECTOR_SIZE 0x1000
+#define FLASHSIM_BLOCK_SIZE  0x10000
+#define FLASHSIM_PAGE_SIZE   0x100
+#define FLASHSIM_RTC_SIZE    0x300
+#define FLASHSIM_HEAP_SIZE   0xa000
+
+// timing model, defaults are typical datasheet values for
+// common spi nor parts, and may be changed before use
+typedef struct {
+	uint32_t read_call_ns;      // fixed cost per read call
+	uint32_t read_byte_ns;      // per byte read
+	uint32_t program_call_ns;   // fixed cost per program call
+	uint32_t program_page_ns;   // per page (or part page) programmed
+	uint32_t program_byte_ns;   // per byte programmed
+	uint32_t erase_sector_ns;   // 4KB sector erase
+	uint32_t erase_block_ns;    // 64KB block erase
+} flashsim_timing;
+
+typedef struct {
+	uint32_t reads;
+	uint64_t read_bytes;
+	uint32_t writes;
+	uint64_t write_bytes;
+	uint32_t sector_erases;
+	uint32_t block_erases;
+	uint32_t bad_writes;        // writes that tried to set bits (needed an erase)
+	uint32_t allocs;
+	uint32_t heap_peak;         // high-water mark of heap in use
+	uint64_t erase_ns;          // time spent erasing
+	uint64_t program_ns;        // time spent programming
+	uint64_t read_ns;           // time spent reading
+} flashsim_stats;
+
+typedef struct {
+	uint32_t size;
+	uint8_t **sectors;          // NULL for an erased sector
+	uint32_t *erase_count;      // lifetime erases of each sector
+	uint8_t rtc[FLASHSIM_RTC_SIZE];
+	uint64_t clock_ns;          // simulated time
+	uint32_t heap_used;
+	uint32_t power_fail_ops;    // cut the power on this program/erase (counts down, 0 for never)
+	flashsim_stats stats;
+} flashsim_device;
+
+extern flashsim_timing flashsim_time;
+extern flashsim_device *flashsim_dev;
+extern int flashsim_verbose;
+// called when the power is cut (see power_fail_ops), must not return
+// (e.g. longjmp back to the caller's boot loop), by then an interrupted
+// program has written its first half and an interrupted erase is done
+extern void (*flashsim_power_fail)(void);
+
+// create a device with erased flash of the specified size and make it current
+flashsim_device *flashsim_create(uint32_t size);
+void flashsim_destroy(flashsim_device *dev);
+// select the device used by the emulated functions
+void flashsim_select(flashsim_device *dev);
+// clear the statistics (but not the erase counts) of the current device
+void flashsim_reset_stats(void);
+// advance the simulated clock
+void flashsim_delay_ns(uint64_t ns);
+
+// direct access to flash contents, bypassing the timing model
+void flashsim_load(uint32_t addr, const void *data, uint32_t len);
+void flashsim_peek(uint32_t addr, void *data, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
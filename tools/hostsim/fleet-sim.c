@@ -0,0 +1,450 @@
+//////////////////////////////////////////////////
+// rBoot fleet rollout simulator, runs on the host.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Simulates rolling releases out to a fleet of devices, each with its own
+// emulated flash and rtc memory, running the real rBoot find_image and
+// stage2a load_rom and the real api ota writes. Power cuts, dropped
+// downloads and corrupted sectors are injected at random. Reports the time
+// to full rollout, how often rBoot had to fall back to the old rom, flash
+// wear and boot time percentiles. Devices are shared between worker
+// processes (one per core by default) and each is simulated in turn, so
+// memory use doesn't grow with the fleet. Needs a 64 bit Linux host (see
+// bootsim.h).
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <c_types.h>
+#include <spi_flash.h>
+
+#include "bootsim.h"
+#include "rboot-api.h"
+
+#define FLASH_SIZE   0x400000
+#define IRAM_LEN     0x6000
+#define CHUNK        1460
+// boot time histogram, 10us buckets up to 1s
+#define HIST_NS      10000
+#define HIST_BUCKETS 100000
+
+typedef struct {
+	uint32_t devices;
+	uint32_t jobs;
+	uint32_t releases;
+	uint32_t attempts;    // download attempts per release before giving up
+	uint32_t seed;
+	uint32_t irom_len;
+	double power_cut;     // probabilities, per download attempt
+	double drop;
+	double corrupt;
+	double poll_s;        // devices find a release at a random time up to this
+	double retry_s;       // wait after a failed attempt
+	double kbps_min;      // download speed of each device, chosen at random
+	double kbps_max;
+} fleet_params;
+
+typedef struct {
+	double done_s;        // when the last release was running, < 0 if never
+	uint32_t attempts;
+	uint32_t power_cuts;
+	uint32_t drops;
+	uint32_t corruptions;
+	uint32_t fallbacks;
+	uint32_t boots;
+	uint32_t worst_erases; // most erases of any one sector
+	uint32_t config_erases;
+	uint8_t bricked;       // no good rom
+	uint8_t corrupt_rom;   // running a corrupted rom rBoot couldn't detect
+} device_result;
+
+static fleet_params params = {
+	1000, 0, 1, 5, 1, 300 * 1024,
+	0.05, 0.10, 0.01,
+	3600.0, 300.0, 20.0, 200.0
+};
+
+static uint8_t **images;
+static uint32_t *image_lens;
+
+// state of the device being simulated, kept out of main's frame so it
+// survives a longjmp on a power cut
+static struct {
+	flashsim_device *dev;
+	device_result *res;
+	uint32_t *hist;
+	uint32_t rng;
+	double t;
+	int slot_release[2];
+	uint8_t slot_corrupt[2];
+	uint32_t slot_addr[2];
+} sim;
+
+static jmp_buf power_jmp;
+
+static void power_fail(void) {
+	longjmp(power_jmp, 1);
+}
+
+// xorshift32, so each device's run is repeatable whatever worker it is on
+static uint32_t rng(void) {
+	sim.rng ^= sim.rng << 13;
+	sim.rng ^= sim.rng >> 17;
+	sim.rng ^= sim.rng << 5;
+	return sim.rng;
+}
+
+static double rng_unit(void) {
+	return rng() / 4294967296.0;
+}
+
+// boot the device, returns the rom booted or -1 if none was good
+static int device_boot(int power_on) {
+	uint64_t start = sim.dev->clock_ns;
+	uint64_t bucket;
+	uint32_t addr;
+
+	// rtc memory is lost with the power
+	if (power_on) memset(sim.dev->rtc, 0xff, FLASHSIM_RTC_SIZE);
+	memcpy((void*)BOOTSIM_RTC_ADDR, sim.dev->rtc, FLASHSIM_RTC_SIZE);
+	addr = find_image();
+	if (addr) load_rom(addr);
+	memcpy(sim.dev->rtc, (void*)BOOTSIM_RTC_ADDR, FLASHSIM_RTC_SIZE);
+
+	bucket = (sim.dev->clock_ns - start) / HIST_NS;
+	sim.hist[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1]++;
+	sim.t += (sim.dev->clock_ns - start) / 1e9;
+	sim.res->boots++;
+	return addr ? rboot_get_current_rom() : -1;
+}
+
+// flip a bit in a random sector of a rom
+static void corrupt_rom(uint32_t addr, uint32_t len) {
+	uint8_t sector[SECTOR_SIZE];
+	uint32_t pos = addr + (rng() % len);
+	pos -= pos % SECTOR_SIZE;
+	flashsim_peek(pos, sector, SECTOR_SIZE);
+	sector[rng() % SECTOR_SIZE] ^= 1 << (rng() % 8);
+	flashsim_load(pos, sector, SECTOR_SIZE);
+}
+
+// download and write a release to a slot, then make it the current rom,
+// returns false if the download dropped or a write failed
+static bool device_download(uint32_t release, uint8_t target, double kbps) {
+	rboot_write_status status;
+	uint32_t len = image_lens[release];
+	uint32_t drop_at = len;
+	uint32_t pos;
+	uint32_t chunk;
+	uint64_t start = sim.dev->clock_ns;
+	bool ok = true;
+
+	if (rng_unit() < params.drop) {
+		drop_at = rng() % len;
+	}
+	status = rboot_write_init(sim.slot_addr[target]);
+	for (pos = 0; pos < len && ok; pos += chunk) {
+		chunk = (len - pos < CHUNK) ? len - pos : CHUNK;
+		if (pos + chunk > drop_at) {
+			sim.res->drops++;
+			ok = false;
+			break;
+		}
+		sim.t += chunk / (kbps * 1024.0);
+		ok = rboot_write_flash(&status, images[release] + pos, chunk);
+	}
+	ok = ok && rboot_write_end(&status);
+	if (ok) {
+		sim.slot_release[target] = release;
+		ok = rboot_set_current_rom(target);
+	}
+	sim.t += (sim.dev->clock_ns - start) / 1e9;
+	return ok;
+}
+
+static void simulate_device(uint32_t id, device_result *res, uint32_t *hist) {
+	uint32_t release;
+	uint32_t attempt;
+	int booted;
+	uint8_t target;
+	double kbps;
+	uint32_t loop;
+
+	memset(&sim, 0, sizeof(sim));
+	sim.res = res;
+	sim.hist = hist;
+	sim.rng = (params.seed * 2654435761u) ^ ((id + 1) * 40503u);
+	if (sim.rng == 0) sim.rng = 1;
+	sim.dev = flashsim_create(FLASH_SIZE);
+	if (!sim.dev) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	kbps = params.kbps_min + rng_unit() * (params.kbps_max - params.kbps_min);
+
+	// factory state, release 0 in the first slot, no config yet
+	flashsim_load(0, images[0], 8);
+	flashsim_load(SECTOR_SIZE * (BOOT_CONFIG_SECTOR + 1), images[0], image_lens[0]);
+	booted = device_boot(1);
+	sim.slot_addr[0] = rboot_get_config().roms[0];
+	sim.slot_addr[1] = rboot_get_config().roms[1];
+	sim.slot_release[0] = 0;
+	sim.slot_release[1] = -1;
+	res->done_s = -1;
+
+	for (release = 1; release <= params.releases && booted >= 0; release++) {
+		sim.t += rng_unit() * params.poll_s;
+		for (attempt = 0; sim.slot_release[booted] != (int)release; attempt++) {
+			if (attempt == params.attempts) goto done;
+			res->attempts++;
+			target = booted ? 0 : 1;
+			sim.slot_release[target] = -1;
+			sim.slot_corrupt[target] = 0;
+
+			if (setjmp(power_jmp)) {
+				// power cut part way through, the app starts again after
+				// booting whatever rBoot picks
+				sim.dev->power_fail_ops = 0;
+				res->power_cuts++;
+				booted = device_boot(1);
+				if (booted < 0) goto done;
+				sim.t += params.retry_s;
+				continue;
+			}
+			if (rng_unit() < params.power_cut) {
+				// somewhere in the writes, erases and config update
+				sim.dev->power_fail_ops = 1 + rng() % (image_lens[release] / CHUNK + image_lens[release] / SECTOR_SIZE + 4);
+			}
+			if (!device_download(release, target, kbps)) {
+				sim.dev->power_fail_ops = 0;
+				sim.t += params.retry_s;
+				continue;
+			}
+			sim.dev->power_fail_ops = 0;
+			if (rng_unit() < params.corrupt) {
+				res->corruptions++;
+				sim.slot_corrupt[target] = 1;
+				corrupt_rom(sim.slot_addr[target], image_lens[release]);
+			}
+			booted = device_boot(0);
+			if (booted < 0) goto done;
+			if (booted != target) {
+				res->fallbacks++;
+				sim.t += params.retry_s;
+			}
+		}
+	}
+	if (booted >= 0 && sim.slot_release[booted] == (int)params.releases) {
+		res->done_s = sim.t;
+	}
+
+done:
+	res->bricked = (booted < 0);
+	res->corrupt_rom = (booted >= 0 && sim.slot_corrupt[booted]);
+	for (loop = 0; loop < FLASH_SIZE / SECTOR_SIZE; loop++) {
+		if (sim.dev->erase_count[loop] > res->worst_erases) res->worst_erases = sim.dev->erase_count[loop];
+	}
+	res->config_erases = sim.dev->erase_count[BOOT_CONFIG_SECTOR];
+	flashsim_destroy(sim.dev);
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+// value at a percentile of a sorted array
+#define PERCENTILE(array, count, pc) ((array)[(count) ? (uint32_t)(((count) - 1) * (pc) / 100.0 + 0.5) : 0])
+
+static double hist_percentile(const uint64_t *hist, uint64_t total, double pc) {
+	uint64_t want = (uint64_t)(total * pc / 100.0 + 0.5);
+	uint64_t seen = 0;
+	uint32_t loop;
+	if (want == 0) want = 1;
+	for (loop = 0; loop < HIST_BUCKETS; loop++) {
+		seen += hist[loop];
+		if (seen >= want) break;
+	}
+	return (loop + 0.5) * HIST_NS / 1e6;
+}
+
+static void report(device_result *results, uint32_t *hists) {
+	static const double pcs[] = { 50, 90, 99, 100 };
+	device_result total;
+	double *done;
+	uint32_t *worst;
+	uint32_t *config;
+	uint64_t *hist;
+	uint64_t boots = 0;
+	uint32_t updated = 0;
+	uint32_t fell_back = 0;
+	uint32_t loop;
+	uint32_t job;
+
+	memset(&total, 0, sizeof(total));
+	done = malloc(params.devices * sizeof(double));
+	worst = malloc(params.devices * sizeof(uint32_t));
+	config = malloc(params.devices * sizeof(uint32_t));
+	hist = calloc(HIST_BUCKETS, sizeof(uint64_t));
+	for (loop = 0; loop < params.devices; loop++) {
+		device_result *res = &results[loop];
+		if (res->done_s >= 0) done[updated++] = res->done_s;
+		worst[loop] = res->worst_erases;
+		config[loop] = res->config_erases;
+		total.attempts += res->attempts;
+		total.power_cuts += res->power_cuts;
+		total.drops += res->drops;
+		total.corruptions += res->corruptions;
+		total.fallbacks += res->fallbacks;
+		total.bricked += res->bricked;
+		total.corrupt_rom += res->corrupt_rom;
+		if (res->fallbacks) fell_back++;
+	}
+	for (job = 0; job < params.jobs; job++) {
+		for (loop = 0; loop < HIST_BUCKETS; loop++) {
+			hist[loop] += hists[job * HIST_BUCKETS + loop];
+			boots += hists[job * HIST_BUCKETS + loop];
+		}
+	}
+	qsort(done, updated, sizeof(double), cmp_double);
+	qsort(worst, params.devices, sizeof(uint32_t), cmp_u32);
+	qsort(config, params.devices, sizeof(uint32_t), cmp_u32);
+
+	printf("\n%-12s", "rollout s");
+	for (loop = 0; loop < sizeof(pcs) / sizeof(pcs[0]); loop++) {
+		// percentiles of the whole fleet, not just the devices that made it
+		uint32_t index = (uint32_t)((params.devices - 1) * pcs[loop] / 100.0 + 0.5);
+		if (index < updated) printf("  %3.0f%% %9.1f", pcs[loop], done[index]);
+		else printf("  %3.0f%% %9s", pcs[loop], "never");
+	}
+	printf("\n%-12s  %u of %u (%.2f%%), %u gave up, %u with no good rom\n", "updated", updated, params.devices,
+		100.0 * updated / params.devices, params.devices - updated - total.bricked, total.bricked);
+	printf("%-12s  %.2f per device, %u power cuts, %u dropped, %u corrupted\n", "attempts",
+		(double)total.attempts / params.devices, total.power_cuts, total.drops, total.corruptions);
+	printf("%-12s  %u on %u devices (%.2f%%), %u running an undetected corrupt rom\n", "fallbacks",
+		total.fallbacks, fell_back, 100.0 * fell_back / params.devices, total.corrupt_rom);
+	printf("%-12s  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f  (%llu boots)\n", "boot ms",
+		hist_percentile(hist, boots, 50), hist_percentile(hist, boots, 90),
+		hist_percentile(hist, boots, 99), hist_percentile(hist, boots, 100), (unsigned long long)boots);
+	printf("%-12s  p50 %u  p99 %u  max %u\n", "worst sector", PERCENTILE(worst, params.devices, 50),
+		PERCENTILE(worst, params.devices, 99), worst[params.devices - 1]);
+	printf("%-12s  p50 %u  p99 %u  max %u\n", "config", PERCENTILE(config, params.devices, 50),
+		PERCENTILE(config, params.devices, 99), config[params.devices - 1]);
+
+	free(done);
+	free(worst);
+	free(config);
+	free(hist);
+}
+
+static void usage(void) {
+	printf("Usage: fleet-sim [-n devices] [-j jobs] [-r releases] [-a attempts] [-s seed]\n");
+	printf("                 [-i irom_size] [-p power_cut] [-d drop] [-c corrupt]\n");
+	printf("                 [-t poll_s] [-w retry_s] [-k kbps_min kbps_max] [-v]\n");
+}
+
+int main(int argc, char *argv[]) {
+	device_result *results;
+	uint32_t *hists;
+	uint32_t release;
+	uint32_t job;
+	uint32_t id;
+	int status;
+	int ok = 1;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) params.devices = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc) params.jobs = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc) params.releases = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-a") && i + 1 < argc) params.attempts = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc) params.seed = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-i") && i + 1 < argc) params.irom_len = strtoul(argv[++i], NULL, 0) & ~3;
+		else if (!strcmp(argv[i], "-p") && i + 1 < argc) params.power_cut = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-d") && i + 1 < argc) params.drop = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-c") && i + 1 < argc) params.corrupt = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc) params.poll_s = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-w") && i + 1 < argc) params.retry_s = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-k") && i + 2 < argc) {
+			params.kbps_min = atof(argv[++i]);
+			params.kbps_max = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-v")) flashsim_verbose = 1;
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (params.jobs == 0) params.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (params.jobs > params.devices) params.jobs = params.devices;
+	if (params.devices == 0 || params.jobs == 0 || params.irom_len > 0xf0000 || params.kbps_min <= 0 ||
+		params.kbps_max < params.kbps_min) {
+		fprintf(stderr, "Invalid parameters.\n");
+		return 1;
+	}
+
+	if (!bootsim_map()) {
+		fprintf(stderr, "Can't map esp8266 address space.\n");
+		return 1;
+	}
+	flashsim_power_fail = power_fail;
+
+	// release 0 is on the devices from the factory
+	images = malloc((params.releases + 1) * sizeof(uint8_t*));
+	image_lens = malloc((params.releases + 1) * sizeof(uint32_t));
+	for (release = 0; release <= params.releases; release++) {
+		srand(params.seed + release);
+		images[release] = malloc(params.irom_len + IRAM_LEN + 0x1000);
+		image_lens[release] = bootsim_make_rom(images[release], params.irom_len, IRAM_LEN);
+	}
+
+	// shared with the workers, each fills in its own devices and histogram
+	results = mmap(NULL, params.devices * sizeof(device_result), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	hists = mmap(NULL, params.jobs * HIST_BUCKETS * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (results == MAP_FAILED || hists == MAP_FAILED) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+
+	printf("rBoot fleet simulation, %u devices, %u release%s of %u bytes, %u jobs\n", params.devices,
+		params.releases, params.releases == 1 ? "" : "s", image_lens[1], params.jobs);
+	printf("per attempt: power cut %.3f, dropped download %.3f, corrupted sector %.3f\n",
+		params.power_cut, params.drop, params.corrupt);
+	fflush(stdout);
+
+	for (job = 0; job < params.jobs; job++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "Can't start worker.\n");
+			return 1;
+		}
+		if (pid == 0) {
+			for (id = job; id < params.devices; id += params.jobs) {
+				simulate_device(id, &results[id], &hists[job * HIST_BUCKETS]);
+			}
+			_exit(0);
+		}
+	}
+	for (job = 0; job < params.jobs; job++) {
+		if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = 0;
+	}
+	if (!ok) {
+		fprintf(stderr, "Worker failed.\n");
+		return 1;
+	}
+
+	report(results, hists);
+	return 0;
+}
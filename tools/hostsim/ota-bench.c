@@ -0,0 +1,237 @@
+//////////////////////////////////////////////////
+// rBoot OTA benchmark, runs on the host.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Streams an image through the real rBoot api write functions, on the
+// emulated flash, with a range of chunk sizes and write strategies, and
+// reports simulated time, erase/program split, heap high-water mark and
+// flash wear (including how often the config sector is rewritten).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <c_types.h>
+#include <spi_flash.h>
+
+#include "rboot-api.h"
+#include "flashsim.h"
+
+#define FLASH_SIZE 0x400000
+#define ROM0_ADDR  0x002000
+#define ROM1_ADDR  0x202000
+
+typedef enum {
+	MODE_STREAM,     // rboot_write_flash, erase as we go
+	MODE_PREERASE,   // rboot_write_erase up front, then rboot_write_flash
+	MODE_CHUNK       // rboot_chunk_write, pages in random order
+} bench_mode;
+
+static const char *mode_names[] = { "stream", "pre-erase", "chunk" };
+
+static uint8_t *image;
+static uint32_t image_len = 480 * 1024;
+#ifdef BOOT_OTA_STATS
+// writer's own view of the last stream/pre-erase write
+static rboot_write_stats write_stats;
+#endif
+
+static int write_image(bench_mode mode, uint32_t addr, uint32_t chunk) {
+	uint32_t pos;
+	uint32_t len;
+
+	if (mode == MODE_CHUNK) {
+		rboot_chunk_status status;
+		uint32_t count = (image_len + chunk - 1) / chunk;
+		uint32_t *order = malloc(count * sizeof(uint32_t));
+		uint32_t loop;
+		int ok = 1;
+		// shuffled chunk order, as from several parallel range requests
+		for (loop = 0; loop < count; loop++) order[loop] = loop;
+		for (loop = count - 1; loop > 0; loop--) {
+			uint32_t swap = rand() % (loop + 1);
+			uint32_t tmp = order[loop];
+			order[loop] = order[swap];
+			order[swap] = tmp;
+		}
+		// the first word of the (random) image stands in for its digest
+		if (!rboot_chunk_init(&status, addr, image_len, *(uint32_t*)image, (FLASH_SIZE / SECTOR_SIZE) - 5)) {
+			free(order);
+			return 0;
+		}
+		for (loop = 0; loop < count && ok; loop++) {
+			pos = order[loop] * chunk;
+			len = (image_len - pos < chunk) ? image_len - pos : chunk;
+			ok = rboot_chunk_write(&status, pos, image + pos, len);
+		}
+		free(order);
+		return rboot_chunk_end(&status) && ok;
+	} else {
+		rboot_write_status status = rboot_write_init(addr);
+		if (mode == MODE_PREERASE && !rboot_write_erase(&status, image_len)) {
+			return 0;
+		}
+		for (pos = 0; pos < image_len; pos += len) {
+			len = (image_len - pos < chunk) ? image_len - pos : chunk;
+			if (!rboot_write_flash(&status, image + pos, len)) {
+				return 0;
+			}
+		}
+		if (!rboot_write_end(&status)) {
+			return 0;
+		}
+#ifdef BOOT_OTA_STATS
+		rboot_write_get_stats(&status, &write_stats);
+#endif
+		return 1;
+	}
+}
+
+static void run(bench_mode mode, uint32_t chunk) {
+	flashsim_device *dev;
+	flashsim_stats *st;
+	uint8_t *check;
+	uint64_t start;
+	double ms;
+
+	dev = flashsim_create(FLASH_SIZE);
+	if (!dev) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	flashsim_reset_stats();
+	start = dev->clock_ns;
+
+	if (!write_image(mode, ROM1_ADDR, chunk)) {
+		printf("%-10s %6u  write failed\n", mode_names[mode], chunk);
+		flashsim_destroy(dev);
+		return;
+	}
+
+	// make sure it was written correctly
+	check = malloc(image_len);
+	flashsim_peek(ROM1_ADDR, check, image_len);
+	st = &dev->stats;
+	ms = (dev->clock_ns - start) / 1e6;
+	printf("%-10s %6u %9.1f %7.1f %5u/%-3u %7u %9.1f %9.1f %8u",
+		mode_names[mode], chunk, ms, (image_len / 1024.0) / (ms / 1000.0),
+		st->sector_erases, st->block_erases, st->writes,
+		st->erase_ns / 1e6, st->program_ns / 1e6, st->heap_peak);
+#ifdef BOOT_OTA_STATS
+	// worst write call, as measured by the writer itself
+	if (mode != MODE_CHUNK) printf(" %8.1f", write_stats.worst_call_us / 1000.0);
+	else printf(" %8s", "-");
+#endif
+	printf("%s%s\n", memcmp(check, image, image_len) ? "  DATA MISMATCH" : "",
+		st->bad_writes ? "  UNERASED WRITE" : "");
+	free(check);
+	flashsim_destroy(dev);
+}
+
+// repeated update cycles, alternating roms, to measure wear
+static void run_cycles(uint32_t cycles, uint32_t chunk, uint32_t endurance) {
+	flashsim_device *dev;
+	rboot_config conf;
+	uint32_t loop;
+	uint32_t worst = 0;
+	uint32_t worst_sector = 0;
+	uint32_t config_erases;
+
+	dev = flashsim_create(FLASH_SIZE);
+	if (!dev) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	memset(&conf, 0, sizeof(rboot_config));
+	conf.magic = BOOT_CONFIG_MAGIC;
+	conf.version = BOOT_CONFIG_VERSION;
+	conf.count = 2;
+	conf.roms[0] = ROM0_ADDR;
+	conf.roms[1] = ROM1_ADDR;
+	rboot_set_config(&conf);
+	config_erases = dev->erase_count[BOOT_CONFIG_SECTOR];
+
+	for (loop = 0; loop < cycles; loop++) {
+		uint8_t target = (rboot_get_current_rom() == 0) ? 1 : 0;
+		write_image(MODE_STREAM, (target == 0) ? ROM0_ADDR : ROM1_ADDR, chunk);
+		rboot_set_current_rom(target);
+	}
+	config_erases = dev->erase_count[BOOT_CONFIG_SECTOR] - config_erases;
+
+	for (loop = 0; loop < FLASH_SIZE / SECTOR_SIZE; loop++) {
+		if (dev->erase_count[loop] > worst) {
+			worst = dev->erase_count[loop];
+			worst_sector = loop;
+		}
+	}
+
+	printf("\n%u update cycles (stream, %u byte chunks):\n", cycles, chunk);
+	printf("  config sector erases per update: %.2f\n", (double)config_erases / cycles);
+	printf("  most worn sector: 0x%03x, %.2f erases per update\n", worst_sector, (double)worst / cycles);
+	printf("  updates before %u cycle endurance is reached: %.0f\n", endurance,
+		worst ? (double)endurance * cycles / worst : 0.0);
+	flashsim_destroy(dev);
+}
+
+static void usage(void) {
+	printf("Usage: ota-bench [-s image_size] [-n cycles] [-e endurance] [-v]\n");
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t chunks[] = { 128, 256, 512, 1024, 1460, 2048, 4096 };
+	uint32_t cycles = 20;
+	uint32_t endurance = 100000;
+	uint32_t loop;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-s") && i + 1 < argc) image_len = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc) cycles = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-e") && i + 1 < argc) endurance = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-v")) flashsim_verbose = 1;
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (image_len == 0 || image_len > ROM1_ADDR - ROM0_ADDR) {
+		fprintf(stderr, "Invalid image size.\n");
+		return 1;
+	}
+
+	srand(1);
+	image = malloc(image_len);
+	for (loop = 0; loop < image_len; loop++) {
+		image[loop] = rand();
+	}
+
+	printf("rBoot OTA benchmark, image %u bytes", image_len);
+#ifdef BOOT_BLOCK_ERASE
+	printf(", block erase enabled");
+#endif
+	printf("\n\n%-10s %6s %9s %7s %9s %7s %9s %9s %8s", "mode", "chunk", "time ms",
+		"KB/s", "erase s/b", "writes", "erase ms", "prog ms", "heap");
+#ifdef BOOT_OTA_STATS
+	printf(" %8s", "worst ms");
+#endif
+	printf("\n");
+
+	for (loop = 0; loop < sizeof(chunks) / sizeof(chunks[0]); loop++) {
+		run(MODE_STREAM, chunks[loop]);
+	}
+	for (loop = 0; loop < sizeof(chunks) / sizeof(chunks[0]); loop++) {
+		run(MODE_PREERASE, chunks[loop]);
+	}
+	for (loop = 0; loop < sizeof(chunks) / sizeof(chunks[0]); loop++) {
+		if ((chunks[loop] % RBOOT_CHUNK_PAGE) == 0) run(MODE_CHUNK, chunks[loop]);
+	}
+
+	run_cycles(cycles, 1460, endurance);
+
+	free(image);
+	return 0;
+}
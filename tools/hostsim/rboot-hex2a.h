@@ -0,0 +1,14 @@
+//////////////////////////////////////////////////
+// rBoot host flash emulator.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// host stand-in for the generated stage2a header, boot-sim runs the
+// stage2a code directly so this is only copied to iram, never run
+
+const uint32_t entry_addr = 0x4010fc00;
+const uint32_t _text_addr = 0x4010fc00;
+const uint32_t _text_len = 0x10;
+const uint8_t _text_data[0x10] = { 0 };
@@ -0,0 +1,130 @@
+#!/bin/sh
+#////////////////////////////////////////////////
+# rBoot build option matrix.
+# Copyright 2015 Richard A Burton
+# richardaburton@gmail.com
+# See license.txt for license terms.
+#////////////////////////////////////////////////
+
+# Builds rBoot with each set of options below and reports the section
+# sizes, stage2a size, stack depth of find_image (with its callees) and
+# largest single stack frame and (from boot-sim) the simulated flash
+# time to boot and load a typical rom. Fails if any
+# build doesn't fit in the 4KB boot sector. Run from the top of the
+# tree, usually with 'make matrix'.
+#
+# Sizes need the xtensa toolchain (SIZE, default xtensa-lx106-elf-size)
+# and boot times a 64 bit Linux host. Either is shown as '-' if missing.
+
+MAKE=${MAKE:-make}
+SIZE=${SIZE:-xtensa-lx106-elf-size}
+OUT=${1:-build/matrix}
+BOOT_SECTOR=4096
+
+# name|make options
+MATRIX="default|
+big-flash|RBOOT_BIG_FLASH=1
+rtc|RBOOT_RTC_ENABLED=1
+config-chksum|RBOOT_CONFIG_CHKSUM=1
+gpio|RBOOT_GPIO_ENABLED=1
+gpio-skip|RBOOT_GPIO_SKIP_ENABLED=1
+irom-chksum|RBOOT_IROM_CHKSUM=1
+chksum-mapped|RBOOT_IROM_CHKSUM=1 RBOOT_CHKSUM_MAPPED=1
+max-roms-8|RBOOT_MAX_ROMS=8
+signature|RBOOT_SIGNATURE=1
+installer|RBOOT_INSTALLER=1
+recovery|RBOOT_INSTALLER=1 RBOOT_RECOVERY=1 RBOOT_RECOVERY_GPIO=0
+routing|RBOOT_RTC_ENABLED=1 RBOOT_RESET_ROUTING=1
+hibernate|RBOOT_RTC_ENABLED=1 RBOOT_HIBERNATE=1
+stage2a-reloc|RBOOT_STAGE2A_RELOCATE=1
+baudrate|RBOOT_BAUDRATE=115200
+typical|RBOOT_BIG_FLASH=1 RBOOT_RTC_ENABLED=1 RBOOT_CONFIG_CHKSUM=1 RBOOT_GPIO_ENABLED=1
+everything|RBOOT_BIG_FLASH=1 RBOOT_RTC_ENABLED=1 RBOOT_CONFIG_CHKSUM=1 RBOOT_GPIO_ENABLED=1 RBOOT_IROM_CHKSUM=1 RBOOT_INSTALLER=1 RBOOT_RESET_ROUTING=1 RBOOT_HIBERNATE=1 RBOOT_STAGE2A_RELOCATE=1 RBOOT_BAUDRATE=115200"
+
+# section size from 'size -A' output
+section() {
+	awk -v s="$1" '$1 == s { print $2; found = 1 } END { if (!found) print 0 }' "$2"
+}
+
+# call chains from find_image, a function inlined into its caller (or not
+# built with the options) has no frame of its own and so adds nothing
+CHAINS="find_image check_rom check_image chksum_mapped
+find_image install_rom install_page
+find_image recovery install_rom install_page
+find_image recovery check_image chksum_mapped
+find_image recovery recovery_reply
+find_image recovery recovery_getc
+find_image perform_gpio_boot get_gpio16
+find_image perform_gpio_boot get_gpio
+find_image place_stage2a
+find_image default_config
+find_image system_rtc_mem
+find_image get_reset_reason
+find_image calc_chksum"
+
+# deepest stack use of the chains above, from a -fstack-usage file (not
+# counting the rom functions, e.g. SPIRead and ets_printf, they call)
+depth() {
+	echo "$CHAINS" | awk -v su="$1" '
+		BEGIN {
+			while ((getline line < su) > 0) {
+				split(line, col, "\t")
+				n = split(col[1], name, ":")
+				frame[name[n]] = col[2]
+			}
+		}
+		{ total = 0; for (i = 1; i <= NF; i++) total += frame[$i]; if (total > max) max = total }
+		END { print max + 0 }'
+}
+
+mkdir -p "$OUT"
+{
+printf "%-14s %6s %7s %5s %6s %7s %6s %6s %8s %8s\n" "options" ".text" ".rodata" ".data" "bin" "stage2a" \
+	"stack" "(max)" "boot ms" "load ms"
+
+echo "$MATRIX" | while IFS='|' read -r name opts; do
+	dir="$OUT/$name"
+	text=- rodata=- data=- bin=- stage2a=- stack=- maxframe=- boot=- load=-
+	mkdir -p "$dir"
+
+	# bootloader itself, a failed build (e.g. no toolchain) leaves the sizes blank
+	if $MAKE -s RBOOT_BUILD_BASE="$dir/build" RBOOT_FW_BASE="$dir/firmware" RBOOT_STACK_USAGE=1 $opts \
+		"$dir/firmware/rboot.bin" >"$dir/build.log" 2>&1; then
+		$SIZE -A "$dir/build/rboot.elf" >"$dir/size.txt" 2>/dev/null
+		$SIZE -A "$dir/build/rboot-stage2a.elf" >"$dir/size2a.txt" 2>/dev/null
+		text=$(section .text "$dir/size.txt")
+		rodata=$(section .rodata "$dir/size.txt")
+		data=$(section .data "$dir/size.txt")
+		stage2a=$(section .text "$dir/size2a.txt")
+		bin=$(wc -c <"$dir/firmware/rboot.bin")
+		if [ -f "$dir/build/rboot.su" ]; then
+			stack=$(depth "$dir/build/rboot.su")
+			maxframe=$(cut -f2 "$dir/build/rboot.su" | sort -n | tail -1)
+		fi
+		if [ "$bin" -gt $BOOT_SECTOR ]; then
+			bin="$bin!"
+		fi
+	fi
+
+	# simulated boot, with the same options
+	case "$opts" in
+	*RBOOT_CHKSUM_MAPPED=1*) ;;
+	*)
+		if $MAKE -s RBOOT_BUILD_BASE="$dir/build" $opts "$dir/build/boot-sim" >>"$dir/build.log" 2>&1 &&
+			"$dir/build/boot-sim" >"$dir/boot.txt" 2>&1; then
+			boot=$(awk '$1 == "normal" { print $2 }' "$dir/boot.txt")
+			load=$(awk '$1 == "load" { print $2 }' "$dir/boot.txt")
+		fi
+		;;
+	esac
+
+	printf "%-14s %6s %7s %5s %6s %7s %6s %6s %8s %8s\n" "$name" "$text" "$rodata" "$data" "$bin" "$stage2a" \
+		"$stack" "$maxframe" "$boot" "$load"
+	case "$bin" in
+	*!) echo "  $name does not fit in the ${BOOT_SECTOR} byte boot sector" ;;
+	esac
+done
+} | tee "$OUT.txt"
+
+# the loop runs in a subshell, so check its output for failures
+! grep -q "does not fit" "$OUT.txt"
@@ -0,0 +1,186 @@
+//////////////////////////////////////////////////
+// rBoot bundle maker.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Host tool that combines several images (e.g. an app rom and its resources)
+// into one bundle, for the api bundle writer (BOOT_BUNDLE). The bundle is a
+// table of contents, giving the target rom slot (or flash address), length
+// and SHA-256 of each part, followed by the parts themselves.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "rboot-sha256.h"
+
+#define BUNDLE_MAGIC   0x444e4252
+#define BUNDLE_NO_ROM  0xff
+#define MAX_PARTS      4
+#define PART_TOC_LEN   44
+
+typedef struct {
+	uint8_t rom;
+	uint32_t addr;
+	uint32_t length;
+	uint8_t *data;
+} bundle_part;
+
+static int quiet = 0;
+
+// load a whole file into memory
+static uint8_t *load_file(const char *name, uint32_t *len) {
+	FILE *f;
+	long size;
+	uint8_t *buf;
+
+	f = fopen(name, "rb");
+	if (!f) {
+		fprintf(stderr, "Error: can't open file '%s'.\n", name);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(size > 0 ? size : 1);
+	if (!buf || fread(buf, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "Error: can't read file '%s'.\n", name);
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	*len = (uint32_t)size;
+	return buf;
+}
+
+static void write_le32(uint8_t *p, uint32_t val) {
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+}
+
+// parse '<rom>:<file>' or '@<addr>:<file>'
+static int parse_part(char *arg, bundle_part *part) {
+	char *file = strchr(arg, ':');
+	char *end;
+
+	if (!file) return 0;
+	*file++ = 0;
+	if (arg[0] == '@') {
+		part->rom = BUNDLE_NO_ROM;
+		part->addr = strtoul(arg + 1, &end, 0);
+	} else {
+		part->rom = strtoul(arg, &end, 0);
+		part->addr = 0;
+		if (part->rom == BUNDLE_NO_ROM) return 0;
+	}
+	if (*end != 0) return 0;
+	part->data = load_file(file, &part->length);
+	if (!part->data) return 0;
+	if (part->length == 0) {
+		fprintf(stderr, "Error: file '%s' is empty.\n", file);
+		return 0;
+	}
+	if (!quiet) {
+		if (part->rom == BUNDLE_NO_ROM) printf("Adding '%s' for address 0x%08x.\n", file, part->addr);
+		else printf("Adding '%s' for rom %d.\n", file, part->rom);
+	}
+	return 1;
+}
+
+static int write_bundle(const char *name, bundle_part *parts, int count, uint8_t boot) {
+	FILE *f;
+	uint8_t header[8] = { 0 };
+	uint8_t toc[PART_TOC_LEN];
+	rboot_sha256_ctx ctx;
+	int ok;
+	int i;
+
+	f = fopen(name, "wb");
+	if (!f) {
+		fprintf(stderr, "Error: can't open output file '%s'.\n", name);
+		return 0;
+	}
+	write_le32(header, BUNDLE_MAGIC);
+	header[4] = count;
+	header[5] = boot;
+	ok = (fwrite(header, 1, sizeof(header), f) == sizeof(header));
+
+	for (i = 0; ok && i < count; i++) {
+		memset(toc, 0, sizeof(toc));
+		toc[0] = parts[i].rom;
+		write_le32(toc + 4, parts[i].addr);
+		write_le32(toc + 8, parts[i].length);
+		rboot_sha256_init(&ctx);
+		rboot_sha256_update(&ctx, parts[i].data, parts[i].length);
+		rboot_sha256_final(&ctx, toc + 12);
+		ok = (fwrite(toc, 1, sizeof(toc), f) == sizeof(toc));
+	}
+	for (i = 0; ok && i < count; i++) {
+		ok = (fwrite(parts[i].data, 1, parts[i].length, f) == parts[i].length);
+	}
+
+	if (fclose(f) != 0) ok = 0;
+	if (!ok) fprintf(stderr, "Error: write failed.\n");
+	return ok;
+}
+
+static void usage(void) {
+	printf("rBoot bundle maker\n\n");
+	printf("Usage: rboot-bundle [options] <output bundle> <part> [part...]\n\n");
+	printf("  -quiet        only print errors\n");
+	printf("  -boot <rom>   rom to boot once the bundle is installed\n\n");
+	printf("Each part is <rom>:<file> to write file to that rom slot, or\n");
+	printf("@<addr>:<file> to write it to a (sector aligned) flash address.\n");
+}
+
+int main(int argc, char *argv[]) {
+
+	int i;
+	char *outfile = NULL;
+	bundle_part parts[MAX_PARTS];
+	int count = 0;
+	uint8_t boot = BUNDLE_NO_ROM;
+	int ret;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] == '-' && !outfile) {
+			if (!strcmp(argv[i], "-quiet")) quiet = 1;
+			else if (!strcmp(argv[i], "-boot") && i + 1 < argc) boot = strtoul(argv[++i], NULL, 0);
+			else {
+				fprintf(stderr, "Error: unknown option '%s'.\n", argv[i]);
+				usage();
+				return 1;
+			}
+		} else if (!outfile) {
+			outfile = argv[i];
+		} else {
+			if (count == MAX_PARTS) {
+				fprintf(stderr, "Error: too many parts.\n");
+				return 1;
+			}
+			if (!parse_part(argv[i], &parts[count])) {
+				fprintf(stderr, "Error: invalid part '%s'.\n", argv[i]);
+				return 1;
+			}
+			count++;
+		}
+	}
+	if (!outfile || count == 0) {
+		usage();
+		return 1;
+	}
+
+	if (!quiet) printf("Writing bundle '%s'.\n", outfile);
+	ret = write_bundle(outfile, parts, count, boot);
+
+	for (i = 0; i < count; i++) {
+		free(parts[i].data);
+	}
+	return ret ? 0 : 1;
+}
@@ -0,0 +1,284 @@
+//////////////////////////////////////////////////
+// rBoot profile guided linker script maker.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Host tool that makes a variant of an eagle.app.v6.ld style linker script
+// from a function level execution profile. The hottest functions (by count
+// per byte) that fit in an iram budget are placed in .text, the rest of the
+// app's functions in .irom0.text. The app must be built with
+// -ffunction-sections (so each function has its own .text.<name> section)
+// and without ICACHE_FLASH_ATTR on the functions to be placed. Functions
+// from libraries (.a) are left where the base script puts them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define DEFAULT_BUDGET 4096
+#define MAX_NAME       128
+// the base script's catch all for code in iram, and the irom section
+#define TEXT_PATTERN   "*(.literal .text .literal.* .text.*"
+#define IROM_PATTERN   "*(.irom0.literal"
+
+typedef struct {
+	char name[MAX_NAME];
+	uint64_t count;
+	uint32_t size;
+	int hot;
+} ldgen_func;
+
+static int quiet = 0;
+
+static int cmp_name(const void *a, const void *b) {
+	return strcmp(((const ldgen_func*)a)->name, ((const ldgen_func*)b)->name);
+}
+
+// best count per byte first (functions of unknown size last)
+static int cmp_density(const void *a, const void *b) {
+	const ldgen_func *x = a, *y = b;
+	double dx = x->size ? (double)x->count / x->size : 0;
+	double dy = y->size ? (double)y->count / y->size : 0;
+	if (dx != dy) return (dx < dy) ? 1 : -1;
+	return strcmp(x->name, y->name);
+}
+
+static ldgen_func *find_func(ldgen_func *funcs, uint32_t count, const char *name) {
+	ldgen_func key;
+	strncpy(key.name, name, MAX_NAME - 1);
+	key.name[MAX_NAME - 1] = 0;
+	return bsearch(&key, funcs, count, sizeof(ldgen_func), cmp_name);
+}
+
+// read the profile, '<function> <count> [size]' per line
+static ldgen_func *load_profile(const char *name, uint32_t *count) {
+	FILE *f;
+	char buf[256];
+	ldgen_func *funcs = NULL;
+	uint32_t alloc = 0;
+	uint32_t loop;
+	uint32_t used = 0;
+
+	f = fopen(name, "r");
+	if (!f) {
+		fprintf(stderr, "Error: can't open file '%s'.\n", name);
+		return NULL;
+	}
+	while (fgets(buf, sizeof(buf), f)) {
+		char func[MAX_NAME];
+		unsigned long long hits;
+		unsigned int size = 0;
+		char *p = strchr(buf, '#');
+		if (p) *p = 0;
+		if (sscanf(buf, "%127s %llu %u", func, &hits, &size) < 2) continue;
+		if (used == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			funcs = realloc(funcs, alloc * sizeof(ldgen_func));
+			if (!funcs) {
+				fprintf(stderr, "Error: out of memory.\n");
+				fclose(f);
+				return NULL;
+			}
+		}
+		strcpy(funcs[used].name, func);
+		funcs[used].count = hits;
+		funcs[used].size = size;
+		funcs[used].hot = 0;
+		used++;
+	}
+	fclose(f);
+	if (used == 0) {
+		fprintf(stderr, "Error: no functions in '%s'.\n", name);
+		free(funcs);
+		return NULL;
+	}
+
+	// merge repeats
+	qsort(funcs, used, sizeof(ldgen_func), cmp_name);
+	*count = 0;
+	for (loop = 0; loop < used; loop++) {
+		if (*count && !strcmp(funcs[*count - 1].name, funcs[loop].name)) {
+			funcs[*count - 1].count += funcs[loop].count;
+			if (funcs[loop].size) funcs[*count - 1].size = funcs[loop].size;
+		} else {
+			funcs[(*count)++] = funcs[loop];
+		}
+	}
+	return funcs;
+}
+
+// fill in sizes from 'nm -S' output ('<addr> <size> <type> <name>')
+static int load_sizes(const char *name, ldgen_func *funcs, uint32_t count) {
+	FILE *f;
+	char buf[256];
+
+	f = fopen(name, "r");
+	if (!f) {
+		fprintf(stderr, "Error: can't open file '%s'.\n", name);
+		return 0;
+	}
+	while (fgets(buf, sizeof(buf), f)) {
+		char func[MAX_NAME];
+		char type;
+		unsigned int addr;
+		unsigned int size;
+		ldgen_func *entry;
+		if (sscanf(buf, "%x %x %c %127s", &addr, &size, &type, func) != 4) continue;
+		if (type != 'T' && type != 't') continue;
+		entry = find_func(funcs, count, func);
+		if (entry) entry->size = size;
+	}
+	fclose(f);
+	return 1;
+}
+
+static int write_script(const char *inname, const char *outname, const char *profile,
+	ldgen_func *funcs, uint32_t count) {
+	FILE *in;
+	FILE *out;
+	char buf[512];
+	int text = 0;
+	int irom = 0;
+	uint32_t loop;
+
+	in = fopen(inname, "r");
+	if (!in) {
+		fprintf(stderr, "Error: can't open file '%s'.\n", inname);
+		return 0;
+	}
+	out = fopen(outname, "w");
+	if (!out) {
+		fprintf(stderr, "Error: can't open output file '%s'.\n", outname);
+		fclose(in);
+		return 0;
+	}
+	fprintf(out, "/* generated by rboot-ldgen from '%s' and profile '%s', do not edit */\n", inname, profile);
+	while (fgets(buf, sizeof(buf), in)) {
+		char *pos = strstr(buf, TEXT_PATTERN);
+		if (pos && !text) {
+			// library code stays in iram, app code only if it is hot
+			text = 1;
+			fprintf(out, "%.*s*(.literal .text .stub .gnu.warning .gnu.linkonce.literal.* .gnu.linkonce.t.*.literal .gnu.linkonce.t.*)\n",
+				(int)(pos - buf), buf);
+			fprintf(out, "%.*s*.a:*(.literal.* .text.*)\n", (int)(pos - buf), buf);
+			for (loop = 0; loop < count; loop++) {
+				if (funcs[loop].hot) {
+					fprintf(out, "%.*s*(.literal.%s .text.%s)\n", (int)(pos - buf), buf, funcs[loop].name, funcs[loop].name);
+				}
+			}
+			continue;
+		}
+		fputs(buf, out);
+		pos = strstr(buf, IROM_PATTERN);
+		if (pos && !irom) {
+			irom = 1;
+			fprintf(out, "%.*s*(.literal.* .text.*)\n", (int)(pos - buf), buf);
+		}
+	}
+	fclose(in);
+	if (fclose(out) != 0) {
+		fprintf(stderr, "Error: write failed.\n");
+		return 0;
+	}
+	if (!text || !irom) {
+		fprintf(stderr, "Error: '%s' doesn't look like eagle.app.v6.ld (no %s section found).\n",
+			inname, text ? ".irom0.text" : ".text");
+		remove(outname);
+		return 0;
+	}
+	return 1;
+}
+
+static void usage(void) {
+	printf("rBoot profile guided linker script maker\n\n");
+	printf("Usage: rboot-ldgen [options] <base ld> <profile> <output ld>\n\n");
+	printf("  -quiet        only print errors\n");
+	printf("  -budget <n>   bytes of iram for hot functions (default %d)\n", DEFAULT_BUDGET);
+	printf("  -nm <file>    function sizes, from 'nm -S' of the app\n\n");
+	printf("The profile has a function name and a count (e.g. of calls or pc samples)\n");
+	printf("per line, optionally followed by its size, '#' starts a comment.\n");
+}
+
+int main(int argc, char *argv[]) {
+
+	int i;
+	char *basefile = NULL;
+	char *profile = NULL;
+	char *outfile = NULL;
+	char *nmfile = NULL;
+	uint32_t budget = DEFAULT_BUDGET;
+	uint32_t used = 0;
+	uint32_t hot = 0;
+	uint32_t unsized = 0;
+	uint64_t total = 0;
+	uint64_t covered = 0;
+	ldgen_func *funcs;
+	uint32_t count;
+	uint32_t loop;
+	int ret;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-quiet")) quiet = 1;
+		else if (!strcmp(argv[i], "-budget") && i + 1 < argc) budget = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-nm") && i + 1 < argc) nmfile = argv[++i];
+		else if (argv[i][0] == '-') {
+			fprintf(stderr, "Error: unknown option '%s'.\n", argv[i]);
+			usage();
+			return 1;
+		}
+		else if (!basefile) basefile = argv[i];
+		else if (!profile) profile = argv[i];
+		else if (!outfile) outfile = argv[i];
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (!basefile || !profile || !outfile) {
+		usage();
+		return 1;
+	}
+
+	funcs = load_profile(profile, &count);
+	if (!funcs) return 1;
+	if (nmfile && !load_sizes(nmfile, funcs, count)) {
+		free(funcs);
+		return 1;
+	}
+
+	// greedy by count per byte, each function word aligned
+	qsort(funcs, count, sizeof(ldgen_func), cmp_density);
+	for (loop = 0; loop < count; loop++) {
+		uint32_t size = (funcs[loop].size + 3) & ~3;
+		total += funcs[loop].count;
+		if (!funcs[loop].size) {
+			unsized++;
+		} else if (used + size <= budget && funcs[loop].count) {
+			funcs[loop].hot = 1;
+			used += size;
+			covered += funcs[loop].count;
+			hot++;
+		}
+	}
+
+	if (!quiet) {
+		printf("%-32s %10s %6s\n", "hot function", "count", "size");
+		for (loop = 0; loop < count; loop++) {
+			if (funcs[loop].hot) printf("%-32s %10llu %6u\n", funcs[loop].name,
+				(unsigned long long)funcs[loop].count, funcs[loop].size);
+		}
+		printf("\n%u of %u functions, %u of %u bytes of iram budget.\n", hot, count, used, budget);
+		printf("Projected: %.1f%% of profiled execution moves out of the flash cache.\n",
+			total ? 100.0 * covered / total : 0.0);
+		if (unsized) printf("Warning: %u functions have no size (use -nm), left in irom.\n", unsized);
+	}
+
+	// listed in name order, so the script is stable between runs
+	qsort(funcs, count, sizeof(ldgen_func), cmp_name);
+	ret = write_script(basefile, outfile, profile, funcs, count);
+	free(funcs);
+	return ret ? 0 : 1;
+}
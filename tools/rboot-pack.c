@@ -0,0 +1,501 @@
+//////////////////////////////////////////////////
+// rBoot image packer for ESP8266 roms.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Host tool that turns an elf into an rBoot/SDK bootable rom image, or into
+// a c header (used to embed stage2a in rBoot). Command line compatible with
+// esptool2 for the options used by the rBoot Makefile.
+//
+// Unlike a straight section dump, the sections requested are sorted by load
+// address, padded to a multiple of 4 bytes and coalesced where they are
+// address contiguous. This gives fewer, word aligned sections, so fewer and
+// faster SPIRead calls in check_image and stage2a, while keeping the standard
+// rom_header/section_header layout that load_rom understands.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define ROM_MAGIC      0xe9
+#define ROM_MAGIC_NEW1 0xea
+#define ROM_MAGIC_NEW2 0x04
+#define CHKSUM_INIT    0xef
+
+#define MANIFEST_MAGIC 0x4e414d52
+#define SECTOR_SIZE    0x1000
+
+#define IROM_SECTION ".irom0.text"
+#define MAX_SECTIONS 32
+
+// elf32 structures (little endian only, as used by xtensa-lx106)
+typedef struct {
+	uint8_t  e_ident[16];
+	uint16_t e_type;
+	uint16_t e_machine;
+	uint32_t e_version;
+	uint32_t e_entry;
+	uint32_t e_phoff;
+	uint32_t e_shoff;
+	uint32_t e_flags;
+	uint16_t e_ehsize;
+	uint16_t e_phentsize;
+	uint16_t e_phnum;
+	uint16_t e_shentsize;
+	uint16_t e_shnum;
+	uint16_t e_shstrndx;
+} elf32_header;
+
+typedef struct {
+	uint32_t sh_name;
+	uint32_t sh_type;
+	uint32_t sh_flags;
+	uint32_t sh_addr;
+	uint32_t sh_offset;
+	uint32_t sh_size;
+	uint32_t sh_link;
+	uint32_t sh_info;
+	uint32_t sh_addralign;
+	uint32_t sh_entsize;
+} elf32_section;
+
+typedef struct {
+	uint32_t address;
+	uint32_t length;
+	uint8_t *data;
+} pack_section;
+
+static int quiet = 0;
+
+static void debug(const char *msg, const char *arg) {
+	if (!quiet) printf(msg, arg);
+}
+
+// load a whole file into memory
+static uint8_t *load_file(const char *name, uint32_t *len) {
+	FILE *f;
+	long size;
+	uint8_t *buf;
+
+	f = fopen(name, "rb");
+	if (!f) {
+		fprintf(stderr, "Error: can't open file '%s'.\n", name);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(size > 0 ? size : 1);
+	if (!buf || fread(buf, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "Error: can't read file '%s'.\n", name);
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	*len = (uint32_t)size;
+	return buf;
+}
+
+static int check_elf(uint8_t *elf, uint32_t len) {
+	elf32_header *eh = (elf32_header*)elf;
+	if (len < sizeof(elf32_header) || memcmp(eh->e_ident, "\177ELF", 4) != 0) {
+		fprintf(stderr, "Error: not an elf file.\n");
+		return 0;
+	}
+	// class 32 bit, little endian
+	if (eh->e_ident[4] != 1 || eh->e_ident[5] != 1) {
+		fprintf(stderr, "Error: only 32 bit little endian elf files are supported.\n");
+		return 0;
+	}
+	if (eh->e_shentsize != sizeof(elf32_section) ||
+		eh->e_shoff + (uint32_t)eh->e_shnum * sizeof(elf32_section) > len ||
+		eh->e_shstrndx >= eh->e_shnum) {
+		fprintf(stderr, "Error: bad elf section table.\n");
+		return 0;
+	}
+	return 1;
+}
+
+// find a section by name, returns NULL if not present
+static elf32_section *find_section(uint8_t *elf, const char *name) {
+	elf32_header *eh = (elf32_header*)elf;
+	elf32_section *sh = (elf32_section*)(elf + eh->e_shoff);
+	const char *strings = (const char*)(elf + sh[eh->e_shstrndx].sh_offset);
+	int i;
+
+	for (i = 0; i < eh->e_shnum; i++) {
+		if (strcmp(strings + sh[i].sh_name, name) == 0) {
+			return &sh[i];
+		}
+	}
+	return NULL;
+}
+
+// copy a section's data, padded with zeros to a multiple of 4 bytes
+static int get_section(uint8_t *elf, uint32_t elflen, const char *name, pack_section *sect) {
+	elf32_section *sh = find_section(elf, name);
+
+	if (!sh) {
+		fprintf(stderr, "Error: section '%s' not found.\n", name);
+		return 0;
+	}
+	if (sh->sh_offset + sh->sh_size > elflen) {
+		fprintf(stderr, "Error: section '%s' extends past end of file.\n", name);
+		return 0;
+	}
+	sect->address = sh->sh_addr;
+	sect->length = (sh->sh_size + 3) & ~3;
+	sect->data = calloc(1, sect->length ? sect->length : 1);
+	if (!sect->data) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return 0;
+	}
+	memcpy(sect->data, elf + sh->sh_offset, sh->sh_size);
+	return 1;
+}
+
+static int compare_address(const void *a, const void *b) {
+	const pack_section *sa = a, *sb = b;
+	return (sa->address > sb->address) - (sa->address < sb->address);
+}
+
+// sort sections by address, drop empty ones and merge contiguous
+// neighbours, returns the new section count
+static int coalesce_sections(pack_section *sects, int count) {
+	int in, out = 0;
+
+	qsort(sects, count, sizeof(pack_section), compare_address);
+
+	for (in = 0; in < count; in++) {
+		if (sects[in].length == 0) {
+			free(sects[in].data);
+			continue;
+		}
+		if (out > 0 && sects[out - 1].address + sects[out - 1].length == sects[in].address) {
+			pack_section *prev = &sects[out - 1];
+			uint8_t *data = realloc(prev->data, prev->length + sects[in].length);
+			if (!data) {
+				fprintf(stderr, "Error: out of memory.\n");
+				exit(1);
+			}
+			memcpy(data + prev->length, sects[in].data, sects[in].length);
+			prev->data = data;
+			prev->length += sects[in].length;
+			free(sects[in].data);
+			continue;
+		}
+		sects[out++] = sects[in];
+	}
+	return out;
+}
+
+static void write_le32(uint8_t *p, uint32_t val) {
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+}
+
+static int write_bytes(FILE *f, const void *data, uint32_t len, uint32_t *pos) {
+	if (len && fwrite(data, 1, len, f) != len) {
+		fprintf(stderr, "Error: write failed.\n");
+		return 0;
+	}
+	*pos += len;
+	return 1;
+}
+
+static uint8_t add_chksum(uint8_t chksum, const uint8_t *data, uint32_t len) {
+	while (len--) {
+		chksum ^= *data++;
+	}
+	return chksum;
+}
+
+// write a rom image, optionally with the irom section first (new style)
+static int write_bin(const char *name, uint32_t entry, uint8_t flags1, uint8_t flags2,
+	pack_section *irom, int iromchksum, pack_section *sects, int count) {
+
+	FILE *f;
+	uint8_t header[8];
+	uint8_t pad[16];
+	uint8_t chksum = CHKSUM_INIT;
+	uint32_t pos = 0;
+	int i;
+
+	f = fopen(name, "wb");
+	if (!f) {
+		fprintf(stderr, "Error: can't open output file '%s'.\n", name);
+		return 0;
+	}
+
+	if (irom) {
+		// new style header, followed by the irom section
+		header[0] = ROM_MAGIC_NEW1;
+		header[1] = ROM_MAGIC_NEW2;
+		header[2] = flags1;
+		header[3] = flags2;
+		write_le32(header + 4, entry);
+		if (!write_bytes(f, header, 8, &pos)) goto fail;
+		write_le32(header, 0);
+		write_le32(header + 4, irom->length);
+		if (!write_bytes(f, header, 8, &pos)) goto fail;
+		if (!write_bytes(f, irom->data, irom->length, &pos)) goto fail;
+		if (iromchksum) {
+			chksum = add_chksum(chksum, irom->data, irom->length);
+		}
+	}
+
+	// standard header
+	header[0] = ROM_MAGIC;
+	header[1] = (uint8_t)count;
+	header[2] = flags1;
+	header[3] = flags2;
+	write_le32(header + 4, entry);
+	if (!write_bytes(f, header, 8, &pos)) goto fail;
+
+	for (i = 0; i < count; i++) {
+		write_le32(header, sects[i].address);
+		write_le32(header + 4, sects[i].length);
+		if (!write_bytes(f, header, 8, &pos)) goto fail;
+		if (!write_bytes(f, sects[i].data, sects[i].length, &pos)) goto fail;
+		chksum = add_chksum(chksum, sects[i].data, sects[i].length);
+	}
+
+	// pad so the checksum is the last byte of a 16 byte block
+	memset(pad, 0, sizeof(pad));
+	pad[15 - (pos & 0x0f)] = chksum;
+	if (!write_bytes(f, pad, 16 - (pos & 0x0f), &pos)) goto fail;
+
+	fclose(f);
+	return 1;
+
+fail:
+	fclose(f);
+	return 0;
+}
+
+// write a c header containing the entry point and the raw section data
+static int write_header(const char *name, uint32_t entry, char **names, int count,
+	uint8_t *elf, uint32_t elflen) {
+
+	FILE *f;
+	pack_section sect;
+	uint32_t loop;
+	int i;
+	char *c;
+
+	f = fopen(name, "w");
+	if (!f) {
+		fprintf(stderr, "Error: can't open output file '%s'.\n", name);
+		return 0;
+	}
+
+	fprintf(f, "const uint32_t entry_addr = 0x%08x;\n", entry);
+	for (i = 0; i < count; i++) {
+		char *label;
+		if (!get_section(elf, elflen, names[i], &sect)) {
+			fclose(f);
+			return 0;
+		}
+		// section names become c identifiers, '.text' -> '_text'
+		label = strdup(names[i]);
+		for (c = label; *c; c++) {
+			if (*c == '.') *c = '_';
+		}
+		fprintf(f, "\nconst uint32_t %s_addr = 0x%08x;\n", label, sect.address);
+		fprintf(f, "const uint32_t %s_len = %u;\n", label, sect.length);
+		fprintf(f, "const uint8_t  %s_data[] = {", label);
+		for (loop = 0; loop < sect.length; loop++) {
+			fprintf(f, "%s0x%02x", (loop % 16) ? ", " : (loop ? ",\n" : "\n"), sect.data[loop]);
+		}
+		fprintf(f, "\n};\n");
+		free(label);
+		free(sect.data);
+	}
+
+	fclose(f);
+	return 1;
+}
+
+// standard (ieee) crc32
+static uint32_t crc32(const uint8_t *data, uint32_t len) {
+	uint32_t crc = 0xffffffff;
+	int bit;
+	while (len--) {
+		crc ^= *data++;
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+		}
+	}
+	return crc ^ 0xffffffff;
+}
+
+// copy a finished (and optionally signed) rom image, adding a
+// manifest of the crc32 of each sector, for the api scrubber
+static int write_manifest(const char *inname, const char *outname) {
+
+	FILE *f;
+	uint8_t *image;
+	uint8_t *table;
+	uint8_t header[16];
+	uint32_t len;
+	uint32_t count;
+	uint32_t loop;
+	uint32_t pos = 0;
+	int ret;
+
+	image = load_file(inname, &len);
+	if (!image) return 0;
+	if (len == 0 || (len & 3)) {
+		fprintf(stderr, "Error: image length must be a multiple of 4.\n");
+		free(image);
+		return 0;
+	}
+
+	count = (len + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	table = malloc(count * 4);
+	for (loop = 0; loop < count; loop++) {
+		uint32_t sectlen = len - (loop * SECTOR_SIZE);
+		if (sectlen > SECTOR_SIZE) sectlen = SECTOR_SIZE;
+		write_le32(table + (loop * 4), crc32(image + (loop * SECTOR_SIZE), sectlen));
+	}
+	write_le32(header, MANIFEST_MAGIC);
+	write_le32(header + 4, len);
+	write_le32(header + 8, count);
+	write_le32(header + 12, crc32(table, count * 4));
+
+	f = fopen(outname, "wb");
+	if (!f) {
+		fprintf(stderr, "Error: can't open output file '%s'.\n", outname);
+		free(table);
+		free(image);
+		return 0;
+	}
+	ret = write_bytes(f, image, len, &pos) && write_bytes(f, header, sizeof(header), &pos) &&
+		write_bytes(f, table, count * 4, &pos);
+	fclose(f);
+	free(table);
+	free(image);
+	return ret;
+}
+
+static void usage(void) {
+	printf("rBoot image packer\n\n");
+	printf("Usage: rboot-pack -bin [options] <input elf> <output bin> <section> [section...]\n");
+	printf("       rboot-pack -header [options] <input elf> <output h> <section> [section...]\n");
+	printf("       rboot-pack -manifest [options] <input bin> <output bin>\n\n");
+	printf("  -quiet        only print errors\n");
+	printf("  -boot0        old style rom, no .irom0.text section (default)\n");
+	printf("  -boot2        new style rom, .irom0.text section first\n");
+	printf("  -iromchksum   include .irom0.text in the checksum (with -boot2)\n");
+	printf("  -256 -512 -1024 -2048 -2048b -4096 -8192 -16384\n");
+	printf("                flash size in KB (default -512)\n");
+	printf("  -qio -qout -dio -dout\n");
+	printf("                flash mode (default -qio)\n");
+	printf("  -20 -26.7 -40 -80\n");
+	printf("                flash speed in MHz (default -40)\n");
+}
+
+int main(int argc, char *argv[]) {
+
+	int i;
+	int bin = 0, header = 0, manifest = 0, boot2 = 0, iromchksum = 0;
+	uint8_t size = 0, mode = 0, speed = 0;
+	char *infile = NULL, *outfile = NULL;
+	char **names = NULL;
+	int count = 0;
+	uint8_t *elf;
+	uint32_t elflen;
+	pack_section sects[MAX_SECTIONS];
+	pack_section irom;
+	int ret;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] == '-' && !infile) {
+			if (!strcmp(argv[i], "-quiet")) quiet = 1;
+			else if (!strcmp(argv[i], "-bin")) bin = 1;
+			else if (!strcmp(argv[i], "-header")) header = 1;
+			else if (!strcmp(argv[i], "-manifest")) manifest = 1;
+			else if (!strcmp(argv[i], "-boot0")) boot2 = 0;
+			else if (!strcmp(argv[i], "-boot2")) boot2 = 1;
+			else if (!strcmp(argv[i], "-iromchksum")) iromchksum = 1;
+			else if (!strcmp(argv[i], "-512")) size = 0;
+			else if (!strcmp(argv[i], "-256")) size = 1;
+			else if (!strcmp(argv[i], "-1024")) size = 2;
+			else if (!strcmp(argv[i], "-2048")) size = 3;
+			else if (!strcmp(argv[i], "-4096")) size = 4;
+			else if (!strcmp(argv[i], "-2048b")) size = 5;
+			else if (!strcmp(argv[i], "-8192")) size = 8;
+			else if (!strcmp(argv[i], "-16384")) size = 9;
+			else if (!strcmp(argv[i], "-qio")) mode = 0;
+			else if (!strcmp(argv[i], "-qout")) mode = 1;
+			else if (!strcmp(argv[i], "-dio")) mode = 2;
+			else if (!strcmp(argv[i], "-dout")) mode = 3;
+			else if (!strcmp(argv[i], "-40")) speed = 0;
+			else if (!strcmp(argv[i], "-26.7")) speed = 1;
+			else if (!strcmp(argv[i], "-20")) speed = 2;
+			else if (!strcmp(argv[i], "-80")) speed = 0x0f;
+			else {
+				fprintf(stderr, "Error: unknown option '%s'.\n", argv[i]);
+				usage();
+				return 1;
+			}
+		} else if (!infile) {
+			infile = argv[i];
+		} else if (!outfile) {
+			outfile = argv[i];
+		} else {
+			names = &argv[i];
+			count = argc - i;
+			break;
+		}
+	}
+
+	if (manifest && !bin && !header && infile && outfile && count == 0) {
+		debug("Writing manifest '%s'.\n", outfile);
+		return write_manifest(infile, outfile) ? 0 : 1;
+	}
+
+	if (manifest || bin == header || !infile || !outfile || count == 0) {
+		usage();
+		return 1;
+	}
+	if (count > MAX_SECTIONS) {
+		fprintf(stderr, "Error: too many sections.\n");
+		return 1;
+	}
+
+	elf = load_file(infile, &elflen);
+	if (!elf) return 1;
+	if (!check_elf(elf, elflen)) return 1;
+
+	if (header) {
+		debug("Writing header '%s'.\n", outfile);
+		ret = write_header(outfile, ((elf32_header*)elf)->e_entry, names, count, elf, elflen);
+		free(elf);
+		return ret ? 0 : 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!get_section(elf, elflen, names[i], &sects[i])) return 1;
+	}
+	count = coalesce_sections(sects, count);
+	if (count > 0xff) {
+		fprintf(stderr, "Error: too many sections.\n");
+		return 1;
+	}
+
+	if (boot2 && !get_section(elf, elflen, IROM_SECTION, &irom)) return 1;
+
+	debug("Writing rom '%s'.\n", outfile);
+	ret = write_bin(outfile, ((elf32_header*)elf)->e_entry, mode, (size << 4) | speed,
+		boot2 ? &irom : NULL, iromchksum, sects, count);
+
+	free(elf);
+	return ret ? 0 : 1;
+}
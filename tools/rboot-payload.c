@@ -0,0 +1,221 @@
+//////////////////////////////////////////////////
+// rBoot install payload encoder.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Host tool that encodes a rom image as an install payload for rBoot's
+// installer (BOOT_INSTALLER). The payload is a list of ops that build the rom
+// in order: literal bytes, runs of a single byte value, and copies of data
+// already on the device's flash. Given the rom currently on the device (and
+// the flash address it is at) unchanged code becomes copies, so the payload is
+// a delta. Without it, only runs are encoded (e.g. padding and empty data).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define INSTALL_MAGIC      0x4c534e49
+#define INSTALL_OP_END     0x00
+#define INSTALL_OP_LITERAL 0x01
+#define INSTALL_OP_COPY    0x02
+#define INSTALL_OP_FILL    0x03
+
+// an op costs 12 bytes, shorter matches aren't worth it
+#define MIN_COPY  32
+#define MIN_FILL  16
+#define HASH_BITS 20
+
+static int quiet = 0;
+
+static void debug(const char *msg, const char *arg) {
+	if (!quiet) printf(msg, arg);
+}
+
+// load a whole file into memory
+static uint8_t *load_file(const char *name, uint32_t *len) {
+	FILE *f;
+	long size;
+	uint8_t *buf;
+
+	f = fopen(name, "rb");
+	if (!f) {
+		fprintf(stderr, "Error: can't open file '%s'.\n", name);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(size > 0 ? size : 1);
+	if (!buf || fread(buf, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "Error: can't read file '%s'.\n", name);
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	*len = (uint32_t)size;
+	return buf;
+}
+
+static void write_le32(uint8_t *p, uint32_t val) {
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+}
+
+static int write_op(FILE *f, uint8_t type, uint8_t fill, uint32_t len, uint32_t addr) {
+	uint8_t op[12] = { type, fill, 0, 0 };
+	write_le32(op + 4, len);
+	write_le32(op + 8, addr);
+	return (fwrite(op, 1, sizeof(op), f) == sizeof(op));
+}
+
+static int write_literal(FILE *f, const uint8_t *data, uint32_t len) {
+	static const uint8_t pad[3] = { 0, 0, 0 };
+	if (len == 0) return 1;
+	return write_op(f, INSTALL_OP_LITERAL, 0, len, 0) &&
+		fwrite(data, 1, len, f) == len &&
+		fwrite(pad, 1, (4 - (len & 3)) & 3, f) == ((4 - (len & 3)) & 3);
+}
+
+static uint32_t hash(const uint8_t *data) {
+	uint32_t h = 0;
+	int loop;
+	for (loop = 0; loop < MIN_COPY; loop++) {
+		h = (h * 31) + data[loop];
+	}
+	return (h ^ (h >> HASH_BITS)) & ((1 << HASH_BITS) - 1);
+}
+
+static int write_payload(const char *name, const uint8_t *rom, uint32_t romlen,
+	const uint8_t *base, uint32_t baselen, uint32_t baseaddr) {
+
+	FILE *f;
+	int32_t *index = NULL;
+	uint32_t pos = 0;
+	uint32_t lit = 0;
+	uint32_t loop;
+	uint32_t len;
+	uint32_t copied = 0, filled = 0;
+	uint8_t header[8];
+	int ok = 1;
+
+	// index every position in the base rom by a hash of the bytes there
+	if (base && baselen >= MIN_COPY) {
+		index = malloc(sizeof(int32_t) << HASH_BITS);
+		memset(index, 0xff, sizeof(int32_t) << HASH_BITS);
+		for (loop = 0; loop + MIN_COPY <= baselen; loop++) {
+			index[hash(base + loop)] = loop;
+		}
+	}
+
+	f = fopen(name, "wb");
+	if (!f) {
+		fprintf(stderr, "Error: can't open output file '%s'.\n", name);
+		free(index);
+		return 0;
+	}
+	write_le32(header, INSTALL_MAGIC);
+	write_le32(header + 4, romlen);
+	ok = (fwrite(header, 1, sizeof(header), f) == sizeof(header));
+
+	while (ok && pos < romlen) {
+		// run of the same value?
+		for (len = 1; pos + len < romlen && rom[pos + len] == rom[pos]; len++);
+		if (len >= MIN_FILL) {
+			ok = write_literal(f, rom + lit, pos - lit) &&
+				write_op(f, INSTALL_OP_FILL, rom[pos], len, 0);
+			filled += len;
+			pos += len;
+			lit = pos;
+			continue;
+		}
+		// same data in the base rom?
+		if (index && pos + MIN_COPY <= romlen) {
+			int32_t match = index[hash(rom + pos)];
+			if (match >= 0 && !memcmp(base + match, rom + pos, MIN_COPY)) {
+				for (len = MIN_COPY; pos + len < romlen && match + len < baselen &&
+					rom[pos + len] == base[match + len]; len++);
+				ok = write_literal(f, rom + lit, pos - lit) &&
+					write_op(f, INSTALL_OP_COPY, 0, len, baseaddr + match);
+				copied += len;
+				pos += len;
+				lit = pos;
+				continue;
+			}
+		}
+		pos++;
+	}
+	ok = ok && write_literal(f, rom + lit, pos - lit) &&
+		write_op(f, INSTALL_OP_END, 0, 0, 0);
+
+	if (ok && !quiet) {
+		printf("Rom %u bytes, payload %ld bytes (%u copied, %u filled).\n",
+			romlen, ftell(f), copied, filled);
+	}
+	if (fclose(f) != 0) ok = 0;
+	if (!ok) fprintf(stderr, "Error: write failed.\n");
+	free(index);
+	return ok;
+}
+
+static void usage(void) {
+	printf("rBoot install payload encoder\n\n");
+	printf("Usage: rboot-payload [options] <input bin> <output payload>\n\n");
+	printf("  -quiet                only print errors\n");
+	printf("  -base <bin> <addr>    rom already on the device, and its flash address,\n");
+	printf("                        to copy unchanged data from\n");
+}
+
+int main(int argc, char *argv[]) {
+
+	int i;
+	char *infile = NULL, *outfile = NULL, *basefile = NULL;
+	uint32_t baseaddr = 0;
+	uint8_t *rom, *base = NULL;
+	uint32_t romlen, baselen = 0;
+	int ret;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] == '-' && !infile) {
+			if (!strcmp(argv[i], "-quiet")) quiet = 1;
+			else if (!strcmp(argv[i], "-base") && i + 2 < argc) {
+				basefile = argv[++i];
+				baseaddr = strtoul(argv[++i], NULL, 0);
+			} else {
+				fprintf(stderr, "Error: unknown option '%s'.\n", argv[i]);
+				usage();
+				return 1;
+			}
+		} else if (!infile) {
+			infile = argv[i];
+		} else if (!outfile) {
+			outfile = argv[i];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if (!infile || !outfile) {
+		usage();
+		return 1;
+	}
+
+	rom = load_file(infile, &romlen);
+	if (!rom) return 1;
+	if (basefile) {
+		base = load_file(basefile, &baselen);
+		if (!base) return 1;
+	}
+
+	debug("Writing payload '%s'.\n", outfile);
+	ret = write_payload(outfile, rom, romlen, base, baselen, baseaddr);
+
+	free(base);
+	free(rom);
+	return ret ? 0 : 1;
+}
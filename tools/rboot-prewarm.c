@@ -0,0 +1,196 @@
+//////////////////////////////////////////////////
+// rBoot cache prewarm list maker.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Host tool that turns an execution profile of an app into a list of the
+// hottest irom cache lines, as a header (rboot-prewarm-app.h) for the app's
+// copy of rboot-bigflash.c to touch straight after the flash cache is
+// enabled (RBOOT_PREWARM). The profile is a text file of addresses, one per
+// line, each optionally followed by a count (e.g. pc samples or function
+// entry counts), anything after a '#' is ignored.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define IROM_START   0x40200000
+#define IROM_END     0x40300000
+#define DEFAULT_LINE 32
+#define DEFAULT_MAX  256
+
+typedef struct {
+	uint32_t addr;
+	uint64_t count;
+} prewarm_line;
+
+static int quiet = 0;
+
+static int cmp_count(const void *a, const void *b) {
+	const prewarm_line *x = a, *y = b;
+	if (x->count != y->count) return (x->count < y->count) ? 1 : -1;
+	return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static int cmp_addr(const void *a, const void *b) {
+	const prewarm_line *x = a, *y = b;
+	return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+// read the profile, merging entries by cache line
+static prewarm_line *load_profile(const char *name, uint32_t linesize, uint32_t *count, uint64_t *total) {
+	FILE *f;
+	char buf[256];
+	prewarm_line *lines = NULL;
+	uint32_t alloc = 0;
+	uint32_t used = 0;
+	uint32_t skipped = 0;
+	uint32_t loop;
+
+	f = fopen(name, "r");
+	if (!f) {
+		fprintf(stderr, "Error: can't open file '%s'.\n", name);
+		return NULL;
+	}
+	*total = 0;
+	while (fgets(buf, sizeof(buf), f)) {
+		char *p = strchr(buf, '#');
+		char *end;
+		uint32_t addr;
+		uint64_t hits;
+
+		if (p) *p = 0;
+		addr = strtoul(buf, &end, 16);
+		if (end == buf) continue;
+		p = end;
+		hits = strtoull(p, &end, 0);
+		if (end == p) hits = 1;
+		if (addr < IROM_START || addr >= IROM_END) {
+			skipped++;
+			continue;
+		}
+		if (used == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			lines = realloc(lines, alloc * sizeof(prewarm_line));
+			if (!lines) {
+				fprintf(stderr, "Error: out of memory.\n");
+				fclose(f);
+				return NULL;
+			}
+		}
+		lines[used].addr = addr - (addr % linesize);
+		lines[used].count = hits;
+		used++;
+		*total += hits;
+	}
+	fclose(f);
+	if (!quiet && skipped) printf("Ignored %u addresses outside irom.\n", skipped);
+	if (used == 0) {
+		fprintf(stderr, "Error: no irom addresses in '%s'.\n", name);
+		free(lines);
+		return NULL;
+	}
+
+	qsort(lines, used, sizeof(prewarm_line), cmp_addr);
+	*count = 0;
+	for (loop = 0; loop < used; loop++) {
+		if (*count && lines[*count - 1].addr == lines[loop].addr) {
+			lines[*count - 1].count += lines[loop].count;
+		} else {
+			lines[(*count)++] = lines[loop];
+		}
+	}
+	return lines;
+}
+
+static int write_header(const char *name, const char *profile, prewarm_line *lines, uint32_t count) {
+	FILE *f;
+	uint32_t loop;
+
+	f = fopen(name, "w");
+	if (!f) {
+		fprintf(stderr, "Error: can't open output file '%s'.\n", name);
+		return 0;
+	}
+	fprintf(f, "#ifndef __RBOOT_PREWARM_APP_H__\n#define __RBOOT_PREWARM_APP_H__\n\n");
+	fprintf(f, "// hottest irom cache lines, generated by rboot-prewarm from '%s'\n\n", profile);
+	fprintf(f, "#define RBOOT_PREWARM_COUNT %u\n\n", count);
+	fprintf(f, "static const uint32_t rboot_prewarm_lines[RBOOT_PREWARM_COUNT] = {");
+	for (loop = 0; loop < count; loop++) {
+		fprintf(f, "%s0x%08x,", (loop % 6) ? " " : "\n\t", lines[loop].addr);
+	}
+	fprintf(f, "\n};\n\n#endif\n");
+	if (fclose(f) != 0) {
+		fprintf(stderr, "Error: write failed.\n");
+		return 0;
+	}
+	return 1;
+}
+
+static void usage(void) {
+	printf("rBoot cache prewarm list maker\n\n");
+	printf("Usage: rboot-prewarm [options] <profile> <output h>\n\n");
+	printf("  -quiet        only print errors\n");
+	printf("  -max <n>      most cache lines to list (default %d)\n", DEFAULT_MAX);
+	printf("  -line <n>     cache line size in bytes (default %d)\n\n", DEFAULT_LINE);
+	printf("The profile has one hex address per line, optionally followed by a\n");
+	printf("count (e.g. of pc samples), '#' starts a comment.\n");
+}
+
+int main(int argc, char *argv[]) {
+
+	int i;
+	char *infile = NULL;
+	char *outfile = NULL;
+	uint32_t max = DEFAULT_MAX;
+	uint32_t linesize = DEFAULT_LINE;
+	prewarm_line *lines;
+	uint32_t count;
+	uint64_t total;
+	uint64_t covered = 0;
+	uint32_t loop;
+	int ret;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-quiet")) quiet = 1;
+		else if (!strcmp(argv[i], "-max") && i + 1 < argc) max = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-line") && i + 1 < argc) linesize = strtoul(argv[++i], NULL, 0);
+		else if (argv[i][0] == '-') {
+			fprintf(stderr, "Error: unknown option '%s'.\n", argv[i]);
+			usage();
+			return 1;
+		}
+		else if (!infile) infile = argv[i];
+		else if (!outfile) outfile = argv[i];
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (!infile || !outfile || max == 0 || linesize == 0 || (linesize & (linesize - 1))) {
+		usage();
+		return 1;
+	}
+
+	lines = load_profile(infile, linesize, &count, &total);
+	if (!lines) return 1;
+
+	// keep the hottest, then list them in flash order
+	qsort(lines, count, sizeof(prewarm_line), cmp_count);
+	if (count > max) count = max;
+	for (loop = 0; loop < count; loop++) {
+		covered += lines[loop].count;
+	}
+	qsort(lines, count, sizeof(prewarm_line), cmp_addr);
+
+	if (!quiet) {
+		printf("Writing '%s', %u lines (%u bytes) covering %.1f%% of the profile.\n", outfile, count,
+			count * linesize, total ? 100.0 * covered / total : 0.0);
+	}
+	ret = write_header(outfile, infile, lines, count);
+	free(lines);
+	return ret ? 0 : 1;
+}
@@ -0,0 +1,335 @@
+//////////////////////////////////////////////////
+// rBoot serial recovery sender.
+// Copyright 2015 Richard A Burton
+// richardaburton@gmail.com
+// See license.txt for license terms.
+//////////////////////////////////////////////////
+
+// Host tool that sends a rom to rBoot's serial recovery (BOOT_RECOVERY)
+// over a serial port. The rom is sent as an install payload (made with
+// rboot-payload, so runs and, given the rom on the device, unchanged code
+// cost almost nothing), or with -raw a plain rom is wrapped as one. rBoot
+// stages the payload in flash at the given address, then installs it to
+// the rom slot and boots it. Each frame has a crc32 and is acked, lost or
+// damaged frames are sent again. Works with a pty too (see boot-sim).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INSTALL_MAGIC      0x4c534e49
+#define INSTALL_OP_END     0x00
+#define INSTALL_OP_LITERAL 0x01
+
+#define RECOVERY_SYNC  0xa5
+#define RECOVERY_ACK   0x06
+#define RECOVERY_NAK   0x15
+#define RECOVERY_START 'S'
+#define RECOVERY_DATA  'D'
+#define RECOVERY_END   'E'
+#define RECOVERY_BLOCK 0x400
+
+#define DEFAULT_BAUD    921600
+#define DEFAULT_RETRIES 10
+#define DEFAULT_TIMEOUT 1000
+// the install itself, erasing and writing the whole rom
+#define END_TIMEOUT     60000
+
+static const struct {
+	uint32_t baud;
+	speed_t speed;
+} bauds[] = {
+	{ 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 }, { 921600, B921600 },
+	{ 1000000, B1000000 }, { 1500000, B1500000 }, { 2000000, B2000000 },
+};
+
+static int quiet = 0;
+static uint32_t retries = 0;
+
+// load a whole file into memory, with room to pad it to a multiple of 4
+static uint8_t *load_file(const char *name, uint32_t *len) {
+	FILE *f;
+	long size;
+	uint8_t *buf;
+
+	f = fopen(name, "rb");
+	if (!f) {
+		fprintf(stderr, "Error: can't open file '%s'.\n", name);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = calloc(1, size + 4);
+	if (!buf || fread(buf, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "Error: can't read file '%s'.\n", name);
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	*len = (uint32_t)size;
+	return buf;
+}
+
+static void write_le32(uint8_t *p, uint32_t val) {
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// wrap a plain rom as an install payload, a single literal op
+static uint8_t *make_payload(const uint8_t *rom, uint32_t romlen, uint32_t *len) {
+	uint32_t padded = (romlen + 3) & ~3;
+	uint8_t *buf = calloc(1, 8 + 12 + padded + 12);
+	if (!buf) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return NULL;
+	}
+	write_le32(buf, INSTALL_MAGIC);
+	write_le32(buf + 4, romlen);
+	buf[8] = INSTALL_OP_LITERAL;
+	write_le32(buf + 12, romlen);
+	memcpy(buf + 20, rom, romlen);
+	buf[20 + padded] = INSTALL_OP_END;
+	*len = 8 + 12 + padded + 12;
+	return buf;
+}
+
+static int open_port(const char *name, uint32_t baud) {
+	struct termios tio;
+	uint32_t loop;
+	int fd;
+
+	for (loop = 0; loop < sizeof(bauds) / sizeof(bauds[0]); loop++) {
+		if (bauds[loop].baud == baud) break;
+	}
+	if (loop == sizeof(bauds) / sizeof(bauds[0])) {
+		fprintf(stderr, "Error: unsupported baud rate %u.\n", baud);
+		return -1;
+	}
+	fd = open(name, O_RDWR | O_NOCTTY);
+	if (fd < 0 || tcgetattr(fd, &tio) != 0) {
+		fprintf(stderr, "Error: can't open serial port '%s'.\n", name);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, bauds[loop].speed);
+	cfsetospeed(&tio, bauds[loop].speed);
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+		fprintf(stderr, "Error: can't set up serial port '%s'.\n", name);
+		close(fd);
+		return -1;
+	}
+	tcflush(fd, TCIOFLUSH);
+	return fd;
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, uint32_t len) {
+	int bit;
+	while (len--) {
+		crc ^= *data++;
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+	return crc;
+}
+
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// wait for the reply to frame seq, returns the reply or 0 on timeout
+static int get_reply(int fd, uint8_t seq, uint32_t timeout) {
+	uint8_t reply[3];
+	uint32_t got = 0;
+	uint64_t end = now_ms() + timeout;
+	uint64_t now;
+	struct pollfd pfd;
+
+	while ((now = now_ms()) < end) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, (int)(end - now)) <= 0) continue;
+		// the line has gone (e.g. the port was unplugged), no reply will come
+		if (!(pfd.revents & POLLIN) || read(fd, reply + got, 1) != 1) return 0;
+		// anything else on the line (e.g. rBoot's messages) is skipped
+		if (got == 0 && reply[0] != RECOVERY_SYNC) continue;
+		if (++got < 3) continue;
+		got = 0;
+		if (reply[2] == seq && (reply[1] == RECOVERY_ACK || reply[1] == RECOVERY_NAK)) {
+			return reply[1];
+		}
+	}
+	return 0;
+}
+
+// send a frame until it is acked, a nak for the end frame is final
+static int send_frame(int fd, uint8_t type, uint8_t seq, const uint8_t *data, uint32_t len,
+	uint32_t timeout, uint32_t tries) {
+	uint8_t frame[5 + RECOVERY_BLOCK + 4];
+	uint32_t loop;
+	int reply;
+
+	frame[0] = RECOVERY_SYNC;
+	frame[1] = type;
+	frame[2] = seq;
+	frame[3] = len & 0xff;
+	frame[4] = (len >> 8) & 0xff;
+	memcpy(frame + 5, data, len);
+	write_le32(frame + 5 + len, crc32(0xffffffff, frame + 1, 4 + len) ^ 0xffffffff);
+
+	for (loop = 0; loop < tries; loop++) {
+		if (loop > 0) retries++;
+		if (write(fd, frame, 5 + len + 4) != (ssize_t)(5 + len + 4)) {
+			fprintf(stderr, "Error: write to serial port failed.\n");
+			return 0;
+		}
+		reply = get_reply(fd, seq, timeout);
+		if (reply == RECOVERY_ACK) return 1;
+		if (reply == RECOVERY_NAK && type == RECOVERY_END) break;
+		if (!quiet) printf("\n%s for frame %u, sending again.\n", reply ? "Nak" : "No reply", seq);
+	}
+	fprintf(stderr, "Error: %s.\n", (type == RECOVERY_START) ? "rBoot didn't accept the start of the transfer" :
+		(type == RECOVERY_END) ? "rBoot couldn't install the rom" : "transfer failed");
+	return 0;
+}
+
+static void usage(void) {
+	printf("rBoot serial recovery sender\n\n");
+	printf("Usage: rboot-recover [options] -stage <addr> <port> <payload>\n\n");
+	printf("  -quiet        only print errors\n");
+	printf("  -stage <a>    flash address to stage the payload at (sector aligned, clear\n");
+	printf("                of the rom slot)\n");
+	printf("  -rom <n>      rom slot to install to (default 0)\n");
+	printf("  -raw          send a plain rom, rather than an rboot-payload file\n");
+	printf("  -baud <n>     as set in rBoot with BOOT_RECOVERY_BAUD (default %d)\n", DEFAULT_BAUD);
+	printf("  -block <n>    bytes of payload per frame (default and max %d)\n", RECOVERY_BLOCK);
+	printf("  -timeout <n>  ms to wait for each ack (default %d)\n", DEFAULT_TIMEOUT);
+	printf("  -retries <n>  times to send a frame before giving up (default %d)\n", DEFAULT_RETRIES);
+}
+
+int main(int argc, char *argv[]) {
+
+	int i;
+	int fd;
+	char *port = NULL;
+	char *infile = NULL;
+	uint32_t stage = 0xffffffff;
+	uint32_t rom = 0;
+	uint32_t baud = DEFAULT_BAUD;
+	uint32_t block = RECOVERY_BLOCK;
+	uint32_t timeout = DEFAULT_TIMEOUT;
+	uint32_t tries = DEFAULT_RETRIES;
+	int raw = 0;
+	uint8_t *file;
+	uint8_t *payload;
+	uint32_t filelen;
+	uint32_t len;
+	uint32_t pos;
+	uint32_t chunk;
+	uint8_t start[9];
+	uint8_t seq = 1;
+	uint64_t started;
+	double secs;
+	int ok;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-quiet")) quiet = 1;
+		else if (!strcmp(argv[i], "-raw")) raw = 1;
+		else if (!strcmp(argv[i], "-stage") && i + 1 < argc) stage = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-rom") && i + 1 < argc) rom = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-baud") && i + 1 < argc) baud = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-block") && i + 1 < argc) block = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-timeout") && i + 1 < argc) timeout = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-retries") && i + 1 < argc) tries = strtoul(argv[++i], NULL, 0);
+		else if (argv[i][0] == '-') {
+			fprintf(stderr, "Error: unknown option '%s'.\n", argv[i]);
+			usage();
+			return 1;
+		}
+		else if (!port) port = argv[i];
+		else if (!infile) infile = argv[i];
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (!port || !infile || stage == 0xffffffff || rom > 0xff || tries == 0 ||
+		block == 0 || block > RECOVERY_BLOCK || (block & 3)) {
+		usage();
+		return 1;
+	}
+	if (stage & 0xfff) {
+		fprintf(stderr, "Error: stage address must be sector aligned.\n");
+		return 1;
+	}
+
+	file = load_file(infile, &filelen);
+	if (!file) return 1;
+	if (raw) {
+		payload = make_payload(file, filelen, &len);
+		free(file);
+		if (!payload) return 1;
+	} else {
+		if (filelen < 8 || read_le32(file) != INSTALL_MAGIC) {
+			fprintf(stderr, "Error: '%s' isn't an install payload (use -raw for a plain rom).\n", infile);
+			free(file);
+			return 1;
+		}
+		payload = file;
+		len = filelen;
+	}
+
+	fd = open_port(port, baud);
+	if (fd < 0) {
+		free(payload);
+		return 1;
+	}
+
+	if (!quiet) printf("Sending %u byte payload to rom %u, staged at 0x%06x.\n", len, rom, stage);
+	started = now_ms();
+	write_le32(start, stage);
+	write_le32(start + 4, len);
+	start[8] = rom;
+	ok = send_frame(fd, RECOVERY_START, seq++, start, sizeof(start), timeout, tries);
+	for (pos = 0; ok && pos < len; pos += chunk) {
+		chunk = (len - pos < block) ? ((len - pos + 3) & ~3) : block;
+		ok = send_frame(fd, RECOVERY_DATA, seq++, payload + pos, chunk, timeout, tries);
+		if (!quiet && (uint64_t)(pos + chunk) * 100 / len != (uint64_t)pos * 100 / len) {
+			printf("\r%3u%%", (pos + chunk >= len) ? 100 : (uint32_t)((uint64_t)(pos + chunk) * 100 / len));
+			fflush(stdout);
+		}
+	}
+	if (ok) {
+		if (!quiet) printf("\nInstalling.\n");
+		ok = send_frame(fd, RECOVERY_END, seq++, NULL, 0, END_TIMEOUT, tries);
+	}
+	close(fd);
+	free(payload);
+	if (!ok) return 1;
+
+	if (!quiet) {
+		secs = (now_ms() - started) / 1000.0;
+		printf("Done, %u bytes in %.1f s (%.1f KB/s), %u frames sent again.\n", len, secs,
+			secs > 0 ? len / 1024.0 / secs : 0.0, retries);
+	}
+	return 0;
+}